@@ -0,0 +1,310 @@
+#include "batch.h"
+#include "threadpool.h"
+#include "parallel.h"
+#include "metrics.h"
+#include "io_pipeline.h"
+#include "indexed_bmp.h"
+#include "result_cache.h"
+#include "kernels.h"
+#include <chrono>
+#include <set>
+#include <sstream>
+
+// Returns the BMP files named by inputs; a directory contributes the .bmp files in it
+vector<path> collect_inputs(const vector<string>& inputs)
+{
+    vector<path> files;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        path input = inputs[i];
+        if (is_directory(input)) {
+            vector<path> entries;
+            for (const directory_entry& entry : directory_iterator(input)) {
+                if (entry.is_regular_file() && entry.path().extension() == ".bmp") {
+                    entries.push_back(entry.path());
+                }
+            }
+            // Directory order is unspecified; keep runs repeatable
+            sort(entries.begin(), entries.end());
+            files.insert(files.end(), entries.begin(), entries.end());
+        }
+        else {
+            files.push_back(input);
+        }
+    }
+    return files;
+}
+
+// Names outputs after the processors that made them, e.g. grayscale_darken for photo_grayscale_darken.bmp
+string process_name(const vector<Operation>& operations)
+{
+    map<int, ImageProcessor> mapOfProcessors = build_processors();
+    string name;
+    for (size_t i = 0; i < operations.size(); i++) {
+        if (i > 0) {
+            name += "_";
+        }
+        name += mapOfProcessors[operations[i].userChoice].name;
+    }
+    return name;
+}
+
+// Returns where the output named processName for inputFile goes, named by createOutputPath
+static path output_path(const path& inputFile, const string& processName, const BatchOptions& options)
+{
+    path outputFile = createOutputPath(inputFile, processName);
+    if (!options.outputDir.empty()) {
+        outputFile = options.outputDir / outputFile.filename();
+    }
+    return outputFile;
+}
+
+// Returns where the output for inputFile goes, named by createOutputPath
+path batch_output_path(const path& inputFile, const BatchOptions& options)
+{
+    return output_path(inputFile, options.processName, options);
+}
+
+// Runs the fan-out recipes over one file; true if every output was written
+static bool fanout_file(const path& inputFile, const BatchOptions& options)
+{
+    vector<path> outputFiles;
+    for (size_t i = 0; i < options.fanout.size(); i++) {
+        outputFiles.push_back(output_path(inputFile, process_name(options.fanout[i]), options));
+    }
+    return process_fanout(inputFile, outputFiles, options.fanout) == (int)options.fanout.size();
+}
+
+/**
+ * Parses a fan-out list such as "3,7,1,4:2" into one recipe per entry.
+ * Entries are processors as for parse_operations, chained with + to make
+ * one output from several, e.g. "3+9:0.4,7".
+ * @param spec    The list of recipes
+ * @param recipes Receives the parsed recipes
+ * @return True if every entry parses and false otherwise
+ */
+static bool parse_fanout(const string& spec, vector<vector<Operation>>& recipes)
+{
+    stringstream list(spec);
+    string entry;
+    while (getline(list, entry, ',')) {
+        replace(entry.begin(), entry.end(), '+', ',');
+        vector<Operation> recipe;
+        if (!parse_operations(entry, recipe)) {
+            return false;
+        }
+        recipes.push_back(recipe);
+    }
+    return !recipes.empty();
+}
+
+/**
+ * Finds an output path that two results would both be written to, as
+ * happens when files from different directories share a name and
+ * --output-dir gathers their outputs in one place.
+ * @param files   The BMP files to process
+ * @param options Where the results go
+ * @return The first output path written twice, or an empty path if there is none
+ */
+static path colliding_output(const vector<path>& files, const BatchOptions& options)
+{
+    set<path> outputs;
+    for (size_t i = 0; i < files.size(); i++) {
+        vector<path> outputFiles;
+        if (options.fanout.empty()) {
+            outputFiles.push_back(batch_output_path(files[i], options));
+        }
+        for (size_t k = 0; k < options.fanout.size(); k++) {
+            outputFiles.push_back(output_path(files[i], process_name(options.fanout[k]), options));
+        }
+        for (size_t k = 0; k < outputFiles.size(); k++) {
+            if (!outputs.insert(outputFiles[k].lexically_normal()).second) {
+                return outputFiles[k];
+            }
+        }
+    }
+    return path();
+}
+
+/**
+ * Processes every file across a work-stealing thread pool.
+ * @param files   The BMP files to process
+ * @param options The operations to run and where to write the results
+ * @return How many files were processed and how many failed
+ */
+BatchSummary run_batch(const vector<path>& files, const BatchOptions& options)
+{
+    BatchSummary summary;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    CacheStats before = result_cache_stats();
+    atomic<int> processed(0);
+    atomic<int> failed(0);
+    mutex report;
+    set_filter_threads(options.imageThreads);
+    {
+        ThreadPool pool(options.threads);
+        for (size_t i = 0; i < files.size(); i++) {
+            path inputFile = files[i];
+            pool.submit([&, inputFile] {
+                bool written = options.fanout.empty()
+                    ? process_file(inputFile, batch_output_path(inputFile, options), options.operations)
+                    : fanout_file(inputFile, options);
+                if (written) {
+                    processed++;
+                }
+                else {
+                    failed++;
+                    lock_guard<mutex> guard(report);
+                    std::cerr << "Could not process " << inputFile.string() << endl;
+                }
+            });
+        }
+        pool.wait();
+    }
+    summary.processed = processed;
+    summary.failed = failed;
+    summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    CacheStats after = result_cache_stats();
+    summary.cacheHits = after.hits - before.hits;
+    summary.cacheMisses = after.misses - before.misses;
+    return summary;
+}
+
+// Prints the command line usage
+static void print_usage()
+{
+    std::cout << "Usage: main (--filter LIST | --fanout LIST) [--threads N] [--image-threads N] [--prefetch N] [--format FORMAT] [--cache DIR]" << endl
+              << "            [--cache-size MB] [--fixed-point] [--cache-link] [--output-dir DIR] FILE_OR_DIR..." << endl
+              << "  LIST is a comma separated list of processor numbers, each optionally" << endl
+              << "  followed by its parameters after colons, e.g. 3,9:0.4 or 6:2:2" << endl
+              << "  16 to 19 end their parameters with a border mode, clamp (the default)," << endl
+              << "  mirror or wrap, e.g. 17:2.5:mirror or 19:wrap" << endl
+              << "  7:auto picks the highcontrast threshold from the image (Otsu), 10:auto" << endl
+              << "  the bwrgb cut-offs from its range, clipping a percent at each end as" << endl
+              << "  20 does, e.g. 10:auto:1 or 20:0.5" << endl
+              << "  --fanout decodes each file once and writes one output per entry of LIST," << endl
+              << "  running them at the same time; + chains processors within an entry," << endl
+              << "  e.g. 3,7,1,3+4 (--prefetch does not apply)" << endl
+              << "  --threads sets how many files run at once and --image-threads how many" << endl
+              << "  threads work on each file (default 1; 0 means one per hardware thread)" << endl
+              << "  --prefetch reads up to N files ahead of the filters and writes behind" << endl
+              << "  them, overlapping disk and CPU time" << endl
+              << "  --format is auto (paletted after highcontrast or bwrgb, the default), 24," << endl
+              << "  indexed (paletted whenever there are at most 256 colours) or rle (indexed" << endl
+              << "  and run length encoded)" << endl
+              << "  --cache keeps results in DIR, keyed by the input pixels and the processors," << endl
+              << "  and copies a result from there when the same work comes again; it holds" << endl
+              << "  --cache-size MB (default 1024), dropping the least recently used, and" << endl
+              << "  --cache-link hard links results instead of copying them" << endl
+              << "  --fixed-point runs claredon, lighten and darken in integer arithmetic," << endl
+              << "  within 1 of the default double results per channel" << endl
+              << "  --output-dir puts the results in DIR, creating it if needed, instead of" << endl
+              << "  next to each input; inputs that would share an output name are refused" << endl;
+    map<int, ImageProcessor> mapOfProcessors = build_processors();
+    for (map<int, ImageProcessor>::iterator it = mapOfProcessors.begin(); it != mapOfProcessors.end(); it++) {
+        std::cout << "  " << it->first << " - " << it->second.name << " - " << it->second.description << endl;
+    }
+}
+
+/**
+ * Runs a batch from command line arguments.
+ * @param argc Argument count
+ * @param argv Arguments
+ * @return The process exit status
+ */
+int batch_main(int argc, char* argv[])
+{
+    BatchOptions options;
+    vector<string> inputs;
+    string filter;
+    string fanout;
+    path cacheDir;
+    uint64_t cacheLimit = DEFAULT_CACHE_LIMIT;
+    bool cacheLink = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value) {
+            filter = argv[++i];
+        }
+        else if (arg == "--fanout" && has_value) {
+            fanout = argv[++i];
+        }
+        else if (arg == "--threads" && has_value) {
+            options.threads = atoi(argv[++i]);
+        }
+        else if (arg == "--image-threads" && has_value) {
+            options.imageThreads = atoi(argv[++i]);
+        }
+        else if (arg == "--prefetch" && has_value) {
+            options.prefetch = atoi(argv[++i]);
+        }
+        else if (arg == "--format" && has_value) {
+            OutputFormat format;
+            if (!parse_output_format(argv[++i], format)) {
+                print_usage();
+                return 1;
+            }
+            set_output_format(format);
+        }
+        else if (arg == "--cache" && has_value) {
+            cacheDir = argv[++i];
+        }
+        else if (arg == "--cache-size" && has_value) {
+            cacheLimit = strtoull(argv[++i], nullptr, 10) << 20;
+        }
+        else if (arg == "--cache-link") {
+            cacheLink = true;
+        }
+        else if (arg == "--fixed-point") {
+            set_fixed_point(true);
+        }
+        else if (arg == "--output-dir" && has_value) {
+            options.outputDir = argv[++i];
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            print_usage();
+            return 1;
+        }
+        else {
+            inputs.push_back(arg);
+        }
+    }
+    bool parsed = fanout.empty() ? parse_operations(filter, options.operations) : filter.empty() && parse_fanout(fanout, options.fanout);
+    if (!parsed || inputs.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    options.processName = process_name(options.operations);
+    if (!cacheDir.empty() && !open_result_cache(cacheDir, cacheLimit, cacheLink)) {
+        std::cerr << "Could not use " << cacheDir.string() << " as a result cache" << endl;
+        return 1;
+    }
+
+    if (!options.outputDir.empty()) {
+        error_code ec;
+        create_directories(options.outputDir, ec);
+        if (!is_directory(options.outputDir)) {
+            std::cerr << "Could not create the output directory " << options.outputDir.string() << endl;
+            return 1;
+        }
+    }
+
+    vector<path> files = collect_inputs(inputs);
+    path clash = colliding_output(files, options);
+    if (!clash.empty()) {
+        std::cerr << "Two results would both be written to " << clash.string()
+                  << " (inputs with the same name need separate output directories)" << endl;
+        return 1;
+    }
+    BatchSummary summary = options.prefetch > 0 && options.fanout.empty() ? run_io_pipeline(files, options) : run_batch(files, options);
+    std::cout << "Processed " << summary.processed << " of " << files.size() << " files ("
+              << summary.failed << " failed) in " << summary.seconds << " s" << endl;
+    if (result_cache_enabled()) {
+        CacheStats cache = result_cache_stats();
+        std::cout << "Result cache: " << summary.cacheHits << " hits, " << summary.cacheMisses << " misses, "
+                  << cache.entries << " results in " << (cache.bytes >> 20) << " MB" << endl;
+    }
+    METRICS_REPORT();
+    return summary.failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "image.h"
+#include "pipeline.h"
+
+// Options of a headless batch run
+struct BatchOptions {
+	vector<Operation> operations;
+	vector<vector<Operation>> fanout; // recipes each written from one decode of the input, instead of operations
+	string processName;   // appended to each output file name
+	path outputDir;       // empty to write each output next to its input
+	int threads = 0;      // worker threads, 0 for one per hardware thread
+	int imageThreads = 1; // threads each filter may use, 0 for one per hardware thread
+	int prefetch = 0;     // files decoded ahead by the read/filter/write pipeline, 0 to run each file start to finish
+};
+
+// Totals of a batch run
+struct BatchSummary {
+	int processed = 0;
+	int failed = 0;
+	double seconds = 0;
+	uint64_t cacheHits = 0;   // files whose result came from the result cache
+	uint64_t cacheMisses = 0; // files looked up in the result cache and processed
+};
+
+// Returns the BMP files named by inputs; a directory contributes the .bmp files in it
+vector<path> collect_inputs(const vector<string>& inputs);
+
+// Returns the name of the processors joined by underscores, appended to output file names
+string process_name(const vector<Operation>& operations);
+
+// Returns where the output for inputFile goes, named by createOutputPath
+path batch_output_path(const path& inputFile, const BatchOptions& options);
+
+// Processes every file across a work-stealing thread pool
+BatchSummary run_batch(const vector<path>& files, const BatchOptions& options);
+
+/**
+ * Runs a batch from command line arguments, for example
+ *   main --filter 3,9:0.4 --threads 8 scans/ extra.bmp
+ *   main --fanout 3,7,1,4 --output-dir variants/ scans/
+ * @return The process exit status
+ */
+int batch_main(int argc, char* argv[]);
+
+#endif
@@ -0,0 +1,256 @@
+#include "image.h"
+#include "metrics.h"
+#include "parallel.h"
+#include "simd.h"
+#include <chrono>
+#include <cstdlib>
+#include <sstream>
+
+// Options of a benchmark run
+struct BenchOptions {
+    vector<pair<int, int>> sizes = { {640, 480}, {1920, 1080}, {4000, 3000} };
+    double minSeconds = 0.25; // time each case for at least this long
+    int minRuns = 3;          // and at least this many times
+    int imageThreads = 1;
+    string simd;              // empty for the best level the CPU supports
+    path workDir = temp_directory_path();
+};
+
+// Measurements of one benchmark case
+struct BenchResult {
+    string name;
+    int width;
+    int height;
+    uint64_t bytes;       // bytes moved by one run
+    int runs;
+    double best;          // seconds of the fastest run
+    double mean;          // seconds per run on average
+    uint64_t allocations; // heap allocations made by one run
+    uint64_t allocated;   // bytes allocated by one run
+};
+
+// Returns a synthetic image with smooth gradients and some noise, the same on every run
+static Image synthetic_image(int width, int height)
+{
+    Image image(width, height);
+    uint32_t state = 2463534242u;
+    for (int y = 0; y < height; y++) {
+        unsigned char* row = image.row(y);
+        for (int x = 0; x < width; x++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            row[3*x]   = (unsigned char)(x * 255 / max(width - 1, 1));
+            row[3*x+1] = (unsigned char)(y * 255 / max(height - 1, 1));
+            row[3*x+2] = (unsigned char)((x + y) / 2 + (state & 31));
+        }
+    }
+    return image;
+}
+
+/**
+ * Runs body until it has taken minSeconds and run minRuns times, then once
+ * more to count its allocations.
+ */
+static BenchResult time_case(const string& name, int width, int height, uint64_t bytes, const BenchOptions& options, const function<void()>& body)
+{
+    BenchResult result = { name, width, height, bytes, 0, 0, 0, 0, 0 };
+    double total = 0;
+    while (result.runs < options.minRuns || total < options.minSeconds) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        body();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (result.runs == 0 || seconds < result.best) {
+            result.best = seconds;
+        }
+        total += seconds;
+        result.runs++;
+    }
+    result.mean = total / result.runs;
+    uint64_t count = allocation_count();
+    uint64_t allocated = allocated_bytes();
+    body();
+    result.allocations = allocation_count() - count;
+    result.allocated = allocated_bytes() - allocated;
+    return result;
+}
+
+// Benchmarks decode, encode and every processor on one image size
+static void bench_size(int width, int height, const BenchOptions& options, vector<BenchResult>& results)
+{
+    Image image = synthetic_image(width, height);
+    string input = (options.workDir / ("image_bench_" + to_string(width) + "x" + to_string(height) + ".bmp")).string();
+    string output = (options.workDir / ("image_bench_" + to_string(width) + "x" + to_string(height) + "_out.bmp")).string();
+    uint64_t file_size = bmp_encoded_size(width, height);
+    uint64_t pixel_bytes = image.stride * height;
+    if (!write_image(input, image)) {
+        cerr << "Could not write " << input << endl;
+        return;
+    }
+
+    results.push_back(time_case("read_image", width, height, file_size, options, [&]() {
+        Image decoded = read_image(input);
+    }));
+    results.push_back(time_case("write_image", width, height, file_size, options, [&]() {
+        write_image(output, image);
+    }));
+
+    map<int, ImageProcessor> mapOfProcessors = build_processors();
+    FilterParams params;
+    params.rotations = 3;
+    params.x_scale = 2;
+    params.y_scale = 2;
+    for (int choice = 1; choice <= 10; choice++) {
+        string name = "process_" + to_string(choice) + "_" + mapOfProcessors[choice].name;
+        results.push_back(time_case(name, width, height, pixel_bytes, options, [&]() {
+            Image processed = apply_processor(image, choice, params);
+        }));
+    }
+    remove(input);
+    remove(output);
+}
+
+// Formats a JSON string value
+static string json_string(const string& text)
+{
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+// Writes the results as a JSON document
+static void write_json(ostream& out, const vector<BenchResult>& results)
+{
+    out << "{" << endl
+        << "  \"simd\": " << json_string(simd_level_name(simd_level())) << "," << endl
+        << "  \"image_threads\": " << filter_threads() << "," << endl
+        << "  \"fixed_point\": " << (fixed_point() ? "true" : "false") << "," << endl
+        << "  \"results\": [" << endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        double megapixels = (double)r.width * r.height / 1e6;
+        out << "    {\"name\": " << json_string(r.name)
+            << ", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"runs\": " << r.runs
+            << ", \"best_seconds\": " << r.best << ", \"mean_seconds\": " << r.mean
+            << ", \"megapixels_per_second\": " << megapixels / r.best
+            << ", \"bytes_per_second\": " << r.bytes / r.best
+            << ", \"allocations\": " << r.allocations << ", \"allocated_bytes\": " << r.allocated << "}"
+            << (i + 1 < results.size() ? "," : "") << endl;
+    }
+    out << "  ]" << endl << "}" << endl;
+}
+
+static void print_usage()
+{
+    std::cout << "Usage: bench [--sizes WxH,...] [--min-time SECONDS] [--runs N] [--image-threads N] [--simd LEVEL] [--fixed-point] [--work-dir DIR] [--output FILE]" << endl
+              << "  Times read_image, write_image and process_1 to process_10 on synthetic" << endl
+              << "  images and prints the results as JSON (to FILE if given); a summary" << endl
+              << "  table goes to standard error. LEVEL is scalar, sse4.1, avx2 or avx512;" << endl
+              << "  --fixed-point times the integer forms of claredon, lighten and darken." << endl;
+}
+
+/**
+ * Parses "640x480,1920x1080" into sizes.
+ * @return True if every entry is a valid size and false otherwise
+ */
+static bool parse_sizes(const string& spec, vector<pair<int, int>>& sizes)
+{
+    sizes.clear();
+    stringstream list(spec);
+    string entry;
+    while (getline(list, entry, ',')) {
+        int width = 0;
+        int height = 0;
+        char separator = 0;
+        stringstream fields(entry);
+        if (!(fields >> width >> separator >> height) || separator != 'x' || width < 1 || height < 1) {
+            return false;
+        }
+        sizes.push_back({ width, height });
+    }
+    return !sizes.empty();
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    string outputFile;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--sizes" && has_value) {
+            if (!parse_sizes(argv[++i], options.sizes)) {
+                print_usage();
+                return 1;
+            }
+        }
+        else if (arg == "--min-time" && has_value) {
+            options.minSeconds = atof(argv[++i]);
+        }
+        else if (arg == "--runs" && has_value) {
+            options.minRuns = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--image-threads" && has_value) {
+            options.imageThreads = atoi(argv[++i]);
+        }
+        else if (arg == "--simd" && has_value) {
+            options.simd = argv[++i];
+        }
+        else if (arg == "--fixed-point") {
+            set_fixed_point(true);
+        }
+        else if (arg == "--work-dir" && has_value) {
+            options.workDir = argv[++i];
+        }
+        else if (arg == "--output" && has_value) {
+            outputFile = argv[++i];
+        }
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    set_filter_threads(options.imageThreads);
+    if (!options.simd.empty()) {
+        bool found = false;
+        for (int level = SIMD_SCALAR; level <= detect_simd_level(); level++) {
+            if (simd_level_name((SimdLevel)level) == options.simd) {
+                set_simd_level((SimdLevel)level);
+                found = true;
+            }
+        }
+        if (!found) {
+            cerr << "Instruction set " << options.simd << " is not supported here" << endl;
+            return 1;
+        }
+    }
+
+    vector<BenchResult> results;
+    for (size_t i = 0; i < options.sizes.size(); i++) {
+        bench_size(options.sizes[i].first, options.sizes[i].second, options, results);
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        cerr << left << setw(26) << r.name << right << setw(6) << r.width << "x" << left << setw(6) << r.height << right
+             << fixed << setprecision(3) << setw(10) << r.best * 1000 << " ms"
+             << setprecision(1) << setw(10) << (double)r.width * r.height / 1e6 / r.best << " MP/s"
+             << setw(10) << r.bytes / r.best / 1e6 << " MB/s"
+             << setw(8) << r.allocations << " allocs" << endl;
+    }
+
+    if (outputFile.empty()) {
+        write_json(std::cout, results);
+        return 0;
+    }
+    ofstream out(outputFile);
+    write_json(out, results);
+    return out ? 0 : 1;
+}
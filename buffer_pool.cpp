@@ -0,0 +1,168 @@
+#include "buffer_pool.h"
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Free lists by size class, with their totals; one lock is plenty at a few buffers per image
+struct BufferPool {
+    mutex lock;
+    map<size_t, vector<unsigned char*>> free_lists;
+    size_t cached_bytes = 0;
+    size_t limit = DEFAULT_POOL_LIMIT;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// Never destroyed, so images released during exit still find it
+static BufferPool& pool()
+{
+    static BufferPool* instance = new BufferPool();
+    return *instance;
+}
+
+/**
+ * Returns the size class a request of size bytes is rounded up to: a
+ * multiple of 64 bytes up to 4 KB, above that a multiple of an eighth of
+ * the power of two below it, which wastes at most an eighth.
+ * @param size Bytes requested
+ * @return Bytes allocated for the request
+ */
+size_t buffer_size_class(size_t size)
+{
+    size_t step = BUFFER_ALIGNMENT;
+    if (size > 4096) {
+        size_t power = 4096;
+        while (power <= size / 2) {
+            power *= 2;
+        }
+        step = power / 8;
+    }
+    return (size + step - 1) / step * step;
+}
+
+// Takes a buffer of the size class from its free list, or allocates one
+static unsigned char* acquire_buffer(size_t capacity)
+{
+    BufferPool& buffers = pool();
+    {
+        lock_guard<mutex> guard(buffers.lock);
+        map<size_t, vector<unsigned char*>>::iterator it = buffers.free_lists.find(capacity);
+        if (it != buffers.free_lists.end() && !it->second.empty()) {
+            unsigned char* data = it->second.back();
+            it->second.pop_back();
+            buffers.cached_bytes -= capacity;
+            buffers.hits++;
+            return data;
+        }
+        buffers.misses++;
+    }
+    void* data = aligned_alloc(BUFFER_ALIGNMENT, capacity);
+    if (data == nullptr) {
+        throw bad_alloc();
+    }
+    return (unsigned char*)data;
+}
+
+// Puts the buffer on the free list of its size class, or frees it if the pool is full
+static void release_buffer(unsigned char* data, size_t capacity)
+{
+    BufferPool& buffers = pool();
+    {
+        lock_guard<mutex> guard(buffers.lock);
+        if (buffers.cached_bytes + capacity <= buffers.limit) {
+            buffers.free_lists[capacity].push_back(data);
+            buffers.cached_bytes += capacity;
+            return;
+        }
+    }
+    free(data);
+}
+
+PixelBuffer::PixelBuffer(size_t size)
+    : data_(nullptr), size_(size), capacity_(0)
+{
+    if (size > 0) {
+        capacity_ = buffer_size_class(size);
+        data_ = acquire_buffer(capacity_);
+    }
+}
+
+PixelBuffer::PixelBuffer(const PixelBuffer& other)
+    : PixelBuffer(other.size_)
+{
+    if (size_ > 0) {
+        memcpy(data_, other.data_, size_);
+    }
+}
+
+PixelBuffer::PixelBuffer(PixelBuffer&& other) noexcept
+    : data_(other.data_), size_(other.size_), capacity_(other.capacity_)
+{
+    other.data_ = nullptr;
+    other.size_ = 0;
+    other.capacity_ = 0;
+}
+
+PixelBuffer& PixelBuffer::operator=(PixelBuffer other) noexcept
+{
+    swap(data_, other.data_);
+    swap(size_, other.size_);
+    swap(capacity_, other.capacity_);
+    return *this;
+}
+
+PixelBuffer::~PixelBuffer()
+{
+    if (data_ != nullptr) {
+        release_buffer(data_, capacity_);
+    }
+}
+
+// Returns true if both hold the same bytes
+bool PixelBuffer::operator==(const PixelBuffer& other) const
+{
+    return size_ == other.size_ && (size_ == 0 || memcmp(data_, other.data_, size_) == 0);
+}
+
+// Sets how many bytes of released buffers the pool may keep; releases beyond it are freed
+void set_buffer_pool_limit(size_t bytes)
+{
+    BufferPool& buffers = pool();
+    bool over;
+    {
+        lock_guard<mutex> guard(buffers.lock);
+        buffers.limit = bytes;
+        over = buffers.cached_bytes > bytes;
+    }
+    if (over) {
+        trim_buffer_pool();
+    }
+}
+
+// Frees every buffer on the free lists
+void trim_buffer_pool()
+{
+    map<size_t, vector<unsigned char*>> lists;
+    BufferPool& buffers = pool();
+    {
+        lock_guard<mutex> guard(buffers.lock);
+        lists.swap(buffers.free_lists);
+        buffers.cached_bytes = 0;
+    }
+    for (map<size_t, vector<unsigned char*>>::iterator it = lists.begin(); it != lists.end(); it++) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            free(it->second[i]);
+        }
+    }
+}
+
+// Returns the counts of the buffer pool
+BufferPoolStats buffer_pool_stats()
+{
+    BufferPool& buffers = pool();
+    lock_guard<mutex> guard(buffers.lock);
+    return BufferPoolStats{ buffers.hits, buffers.misses, buffers.cached_bytes };
+}
@@ -0,0 +1,73 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+using namespace std;
+
+// Alignment of every pooled buffer, one cache line (and one AVX-512 register)
+const size_t BUFFER_ALIGNMENT = 64;
+
+// Default upper bound on the bytes the pool keeps for reuse
+const size_t DEFAULT_POOL_LIMIT = (size_t)1 << 30;
+
+/**
+ * Pixel storage drawn from a process-wide pool of aligned buffers.
+ * Sizes are rounded up to size classes (multiples of 64 bytes up to 4 KB,
+ * then eight classes per power of two) so buffers for similar images are
+ * interchangeable. A released buffer goes back on the free list of its
+ * class and the next request of that class takes it, so a steady stream of
+ * images of similar sizes stops allocating once the pool is warm. The bytes
+ * of a new buffer are not initialised.
+ */
+class PixelBuffer {
+public:
+	PixelBuffer() : data_(nullptr), size_(0), capacity_(0) {}
+	explicit PixelBuffer(size_t size);
+	PixelBuffer(const PixelBuffer& other);
+	PixelBuffer(PixelBuffer&& other) noexcept;
+	PixelBuffer& operator=(PixelBuffer other) noexcept;
+	~PixelBuffer();
+
+	unsigned char* data() { return data_; }
+	const unsigned char* data() const { return data_; }
+	size_t size() const { return size_; }
+	unsigned char* begin() { return data_; }
+	unsigned char* end() { return data_ + size_; }
+	const unsigned char* begin() const { return data_; }
+	const unsigned char* end() const { return data_ + size_; }
+	unsigned char& operator[](size_t i) { return data_[i]; }
+	const unsigned char& operator[](size_t i) const { return data_[i]; }
+
+	// Returns true if both hold the same bytes
+	bool operator==(const PixelBuffer& other) const;
+	bool operator!=(const PixelBuffer& other) const { return !(*this == other); }
+
+private:
+	unsigned char* data_;
+	size_t size_;
+	size_t capacity_;
+};
+
+// Counts of the buffer pool
+struct BufferPoolStats {
+	uint64_t hits;      // buffers handed out from the free lists
+	uint64_t misses;    // buffers newly allocated
+	size_t cachedBytes; // bytes on the free lists
+};
+
+// Returns the size class a request of size bytes is rounded up to
+size_t buffer_size_class(size_t size);
+
+// Sets how many bytes of released buffers the pool may keep; releases beyond it are freed
+void set_buffer_pool_limit(size_t bytes);
+
+// Frees every buffer on the free lists
+void trim_buffer_pool();
+
+// Returns the counts of the buffer pool
+BufferPoolStats buffer_pool_stats();
+
+#endif
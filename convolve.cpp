@@ -0,0 +1,360 @@
+#include "convolve.h"
+#include "kernels.h"
+#include "parallel.h"
+#include <cstring>
+
+// Output rows of a tile, or twice the radius if that is more, so the overlap redone per tile stays small
+const int TILE_ROWS = 64;
+
+// Intermediate bytes a tile may hold, about what stays in L2
+const size_t TILE_BYTES = (size_t)256 << 10;
+
+// Widest tile, which bounds the accumulator rows kept on the stack
+const int MAX_TILE_COLUMNS = 1024;
+
+// Fixed point of the Gaussian taps: they sum to 1 << TAP_SHIFT
+const int TAP_SHIFT = 14;
+
+// Parses "clamp", "mirror" or "wrap" into border; returns false for anything else
+bool parse_border(const string& name, int& border)
+{
+    if (name == "clamp") {
+        border = BORDER_CLAMP;
+    }
+    else if (name == "mirror") {
+        border = BORDER_MIRROR;
+    }
+    else if (name == "wrap") {
+        border = BORDER_WRAP;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Returns the column or row of an image of size n that position i reads.
+ * @param i      Position, possibly outside 0..n - 1
+ * @param n      Size of the image in that direction
+ * @param border How positions outside the image are made up (see BorderMode)
+ * @return A position within 0..n - 1
+ */
+int border_index(int i, int n, int border)
+{
+    if (i >= 0 && i < n) {
+        return i;
+    }
+    if (border == BORDER_WRAP) {
+        return ((i % n) + n) % n;
+    }
+    if (border == BORDER_MIRROR && n > 1) {
+        // Reflections repeat every 2n - 2 positions
+        int period = 2 * n - 2;
+        int m = ((i % period) + period) % period;
+        return m < n ? m : period - m;
+    }
+    return i < 0 ? 0 : n - 1;
+}
+
+// Copies columns x0 - radius to x0 + count + radius - 1 of a row into padded, making up those beyond the edges
+static void pad_row(const unsigned char* row, int width, int x0, int count, int radius, int border, unsigned char* padded)
+{
+    int start = x0 - radius;
+    int first = max(start, 0);
+    int last = min(x0 + count + radius, width);
+    for (int x = start; x < first; x++) {
+        memcpy(padded + 3 * (x - start), row + 3 * border_index(x, width, border), 3);
+    }
+    memcpy(padded + 3 * (first - start), row + 3 * first, 3 * (size_t)(last - first));
+    for (int x = last; x < x0 + count + radius; x++) {
+        memcpy(padded + 3 * (x - start), row + 3 * border_index(x, width, border), 3);
+    }
+}
+
+/**
+ * Runs a separable filter a tile at a time. For a tile of output rows y0
+ * to y1 - 1 and columns x0 to x0 + count - 1, horizontal turns each input
+ * row y0 - radius to y1 + radius - 1, padded by radius pixels each side,
+ * into a row of the intermediate; vertical then turns the intermediate
+ * into the output rows of the tile.
+ * @param image      The input image
+ * @param radius     How far the filter reaches in each direction
+ * @param border     How pixels outside the image are made up
+ * @param horizontal Called as horizontal(padded, count, intermediate_row)
+ * @param vertical   Called as vertical(intermediate, pitch, rows, count, out, out_stride)
+ * @return The filtered image
+ */
+template <typename T, typename Horizontal, typename Vertical>
+static Image run_separable(const Image& image, int radius, int border, Horizontal horizontal, Vertical vertical)
+{
+    Image result(image.width, image.height);
+    int width = image.width;
+    int height = image.height;
+    int tile_rows = max(TILE_ROWS, 2 * radius);
+    size_t span_rows = (size_t)tile_rows + 2 * radius;
+    int tile_columns = (int)min(TILE_BYTES / (span_rows * 3 * sizeof(T)), (size_t)MAX_TILE_COLUMNS);
+    tile_columns = min(max(tile_columns, 16), width);
+    parallel_rows(height, image.stride, [&](int first, int last) {
+        vector<unsigned char> padded(3 * ((size_t)tile_columns + 2 * radius));
+        vector<T> intermediate(span_rows * 3 * tile_columns);
+        for (int y0 = first; y0 < last; y0 += tile_rows) {
+            int y1 = min(y0 + tile_rows, last);
+            int input_rows = y1 - y0 + 2 * radius;
+            for (int x0 = 0; x0 < width; x0 += tile_columns) {
+                int count = min(tile_columns, width - x0);
+                size_t pitch = 3 * (size_t)count;
+                for (int k = 0; k < input_rows; k++) {
+                    int y = border_index(y0 - radius + k, height, border);
+                    pad_row(image.row(y), width, x0, count, radius, border, padded.data());
+                    horizontal(padded.data(), count, intermediate.data() + k * pitch);
+                }
+                vertical(intermediate.data(), pitch, y1 - y0, count, result.row(y0) + 3 * x0, result.stride);
+            }
+        }
+    });
+    return result;
+}
+
+/**
+ * Averages each pixel over the square around it. Both passes keep running
+ * sums, adding the pixel entering the window and taking away the one
+ * leaving it, so the cost per pixel does not grow with the radius.
+ * @param image  The input image
+ * @param radius Half the side of the square, less the centre pixel
+ * @param border How pixels outside the image are made up
+ * @return The blurred image
+ */
+Image box_blur(const Image& image, int radius, int border)
+{
+    radius = min(max(radius, 0), MAX_BLUR_RADIUS);
+    if (radius == 0 || image.empty()) {
+        return image;
+    }
+    int taps = 2 * radius + 1;
+    // Sums reach 255 * taps * taps, which fits 32 bits up to the largest radius
+    uint32_t area = (uint32_t)taps * taps;
+    double reciprocal = 1.0 / area;
+
+    auto horizontal = [=](const unsigned char* padded, int count, uint32_t* out) {
+        for (int c = 0; c < 3; c++) {
+            uint32_t sum = 0;
+            for (int k = 0; k < taps; k++) {
+                sum += padded[3 * k + c];
+            }
+            out[c] = sum;
+            for (int x = 1; x < count; x++) {
+                sum += padded[3 * (x + taps - 1) + c] - padded[3 * (x - 1) + c];
+                out[3 * x + c] = sum;
+            }
+        }
+    };
+    auto vertical = [=](const uint32_t* rows, size_t pitch, int out_rows, int count, unsigned char* out, size_t out_stride) {
+        uint32_t sums[3 * MAX_TILE_COLUMNS];
+        int n = 3 * count;
+        for (int i = 0; i < n; i++) {
+            sums[i] = 0;
+        }
+        for (int k = 0; k < taps; k++) {
+            for (int i = 0; i < n; i++) {
+                sums[i] += rows[k * pitch + i];
+            }
+        }
+        for (int j = 0; j < out_rows; j++) {
+            unsigned char* row = out + j * out_stride;
+            for (int i = 0; i < n; i++) {
+                // Rounded division by the area: a double estimate, corrected by one either way
+                uint32_t numerator = sums[i] + area / 2;
+                uint32_t q = (uint32_t)(numerator * reciprocal);
+                q -= (uint64_t)q * area > numerator;
+                q += (uint64_t)(q + 1) * area <= numerator;
+                row[i] = (unsigned char)q;
+            }
+            if (j + 1 < out_rows) {
+                const uint32_t* entering = rows + (j + taps) * pitch;
+                const uint32_t* leaving = rows + j * pitch;
+                for (int i = 0; i < n; i++) {
+                    sums[i] += entering[i] - leaving[i];
+                }
+            }
+        }
+    };
+    return run_separable<uint32_t>(image, radius, border, horizontal, vertical);
+}
+
+// Returns the radii of three box blurs that together approximate a Gaussian of standard deviation sigma
+static vector<int> gaussian_box_radii(double sigma)
+{
+    // Box widths w and w + 2 mixed so the variances add up to sigma squared
+    const int BOXES = 3;
+    double ideal = sqrt(12 * sigma * sigma / BOXES + 1);
+    int lower = (int)floor(ideal);
+    if (lower % 2 == 0) {
+        lower--;
+    }
+    int upper = lower + 2;
+    double ideal_count = (12 * sigma * sigma - BOXES * lower * lower - 4 * BOXES * lower - 3 * BOXES) / (-4.0 * lower - 4);
+    int lower_count = (int)floor(ideal_count + 0.5);
+    vector<int> radii;
+    for (int i = 0; i < BOXES; i++) {
+        radii.push_back(((i < lower_count ? lower : upper) - 1) / 2);
+    }
+    return radii;
+}
+
+/**
+ * Blurs with a Gaussian of standard deviation sigma. The kernel is sampled
+ * out to 3 sigma and rounded to 14-bit taps that sum exactly to 1, so flat
+ * areas stay exactly flat; the horizontal pass keeps 8 fractional bits for
+ * the vertical one. Wide blurs use three box blurs instead.
+ * @param image  The input image
+ * @param sigma  Standard deviation in pixels, at most MAX_BLUR_RADIUS / 3
+ * @param border How pixels outside the image are made up
+ * @return The blurred image
+ */
+Image gaussian_blur(const Image& image, double sigma, int border)
+{
+    // False for NaN as well
+    if (!(sigma > 0) || image.empty()) {
+        return image;
+    }
+    // Any wider and the kernel radius, or the box radii, would pass MAX_BLUR_RADIUS (or overflow an int)
+    sigma = min(sigma, MAX_BLUR_RADIUS / 3.0);
+    if (sigma > GAUSSIAN_BOX_SIGMA) {
+        vector<int> radii = gaussian_box_radii(sigma);
+        Image blurred = box_blur(image, radii[0], border);
+        for (size_t i = 1; i < radii.size(); i++) {
+            blurred = box_blur(blurred, radii[i], border);
+        }
+        return blurred;
+    }
+    int radius = max(1, (int)ceil(3 * sigma));
+    int taps = 2 * radius + 1;
+    vector<double> weights(taps);
+    double total = 0;
+    for (int k = 0; k < taps; k++) {
+        double d = k - radius;
+        weights[k] = exp(-d * d / (2 * sigma * sigma));
+        total += weights[k];
+    }
+    vector<int32_t> kernel(taps);
+    int32_t sum = 0;
+    for (int k = 0; k < taps; k++) {
+        kernel[k] = (int32_t)floor(weights[k] / total * (1 << TAP_SHIFT) + 0.5);
+        sum += kernel[k];
+    }
+    // Rounding leaves the taps a little off 1; the centre takes the difference
+    kernel[radius] += (1 << TAP_SHIFT) - sum;
+    const int32_t* tap = kernel.data();
+
+    auto horizontal = [=](const unsigned char* padded, int count, uint16_t* out) {
+        int32_t acc[3 * MAX_TILE_COLUMNS];
+        int n = 3 * count;
+        for (int i = 0; i < n; i++) {
+            acc[i] = tap[0] * padded[i];
+        }
+        for (int k = 1; k < taps; k++) {
+            const unsigned char* shifted = padded + 3 * k;
+            for (int i = 0; i < n; i++) {
+                acc[i] += tap[k] * shifted[i];
+            }
+        }
+        // 255 << 14 rounded down to 8 fractional bits still fits 16 bits
+        for (int i = 0; i < n; i++) {
+            out[i] = (uint16_t)((acc[i] + (1 << (TAP_SHIFT - 9))) >> (TAP_SHIFT - 8));
+        }
+    };
+    auto vertical = [=](const uint16_t* rows, size_t pitch, int out_rows, int count, unsigned char* out, size_t out_stride) {
+        int32_t acc[3 * MAX_TILE_COLUMNS];
+        int n = 3 * count;
+        const int shift = TAP_SHIFT + 8;
+        for (int j = 0; j < out_rows; j++) {
+            const uint16_t* base = rows + j * pitch;
+            for (int i = 0; i < n; i++) {
+                acc[i] = tap[0] * base[i];
+            }
+            for (int k = 1; k < taps; k++) {
+                const uint16_t* row = base + k * pitch;
+                for (int i = 0; i < n; i++) {
+                    acc[i] += tap[k] * row[i];
+                }
+            }
+            unsigned char* row = out + j * out_stride;
+            for (int i = 0; i < n; i++) {
+                int value = (acc[i] + (1 << (shift - 1))) >> shift;
+                row[i] = (unsigned char)(value > 255 ? 255 : value);
+            }
+        }
+    };
+    return run_separable<uint16_t>(image, radius, border, horizontal, vertical);
+}
+
+/**
+ * Sharpens by adding back amount times the detail a Gaussian blur removes:
+ * v + amount * (v - blurred), with amount in 8-bit fixed point.
+ * @param image  The input image
+ * @param sigma  Standard deviation of the blur, the size of the detail sharpened
+ * @param amount Strength, 1 doubling the detail
+ * @param border How pixels outside the image are made up
+ * @return The sharpened image
+ */
+Image unsharp_mask(const Image& image, double sigma, double amount, int border)
+{
+    Image result = gaussian_blur(image, sigma, border);
+    int strength = amount > 0 ? (int)lround(min(amount, 64.0) * 256) : 0;
+    int count = image.width * 3;
+    parallel_rows(image.height, image.stride, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            const unsigned char* in = image.row(y);
+            unsigned char* out = result.row(y);
+            for (int i = 0; i < count; i++) {
+                int detail = in[i] - out[i];
+                out[i] = clamp_byte(in[i] + ((detail * strength + 128) >> 8));
+            }
+        }
+    });
+    return result;
+}
+
+/**
+ * Finds edges with the Sobel operator, in its separable form: each row
+ * first gets the vertical smoothing (1 2 1) and difference (-1 0 1) of the
+ * rows around it, then the horizontal difference of the smoothing gives
+ * the x gradient and the horizontal smoothing of the difference the y
+ * gradient. Each channel becomes the length of its gradient.
+ * @param image  The input image
+ * @param border How pixels outside the image are made up
+ * @return The edge image
+ */
+Image sobel_edges(const Image& image, int border)
+{
+    Image result(image.width, image.height);
+    int width = image.width;
+    int height = image.height;
+    parallel_rows(height, image.stride * 3, [&](int first, int last) {
+        // Columns -1 to width of the current row
+        vector<int> smooth(3 * ((size_t)width + 2));
+        vector<int> difference(3 * ((size_t)width + 2));
+        for (int y = first; y < last; y++) {
+            const unsigned char* below = image.row(border_index(y - 1, height, border));
+            const unsigned char* row = image.row(y);
+            const unsigned char* above = image.row(border_index(y + 1, height, border));
+            for (int i = 0; i < width + 2; i++) {
+                int x = border_index(i - 1, width, border);
+                for (int c = 0; c < 3; c++) {
+                    smooth[3 * i + c] = below[3 * x + c] + 2 * row[3 * x + c] + above[3 * x + c];
+                    difference[3 * i + c] = above[3 * x + c] - below[3 * x + c];
+                }
+            }
+            unsigned char* out = result.row(y);
+            for (int i = 0; i < 3 * width; i++) {
+                int gx = smooth[i + 6] - smooth[i];
+                int gy = difference[i] + 2 * difference[i + 3] + difference[i + 6];
+                // Both fit float exactly, and sqrtf is correctly rounded, so every build agrees
+                int magnitude = (int)(sqrtf((float)(gx * gx + gy * gy)) + 0.5f);
+                out[i] = (unsigned char)(magnitude > 255 ? 255 : magnitude);
+            }
+        }
+    });
+    return result;
+}
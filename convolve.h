@@ -0,0 +1,50 @@
+#ifndef CONVOLVE_H
+#define CONVOLVE_H
+
+#include "image.h"
+
+/**
+ * Separable convolution: a horizontal pass over each row into an
+ * intermediate, then a vertical pass down the columns of the intermediate.
+ * Both passes run a tile at a time (a band of rows by a strip of columns
+ * small enough to stay in cache), the bands split across the filter
+ * threads. Pixels outside the image come from the border mode.
+ */
+
+// How pixels beyond the edge are made up
+enum BorderMode {
+	BORDER_CLAMP,  // repeat the edge pixel
+	BORDER_MIRROR, // reflect about the edge pixel: -1 reads 1
+	BORDER_WRAP    // continue from the opposite edge
+};
+
+// Largest blur radius, for box blur and the radius of a Gaussian (3 sigma)
+const int MAX_BLUR_RADIUS = 2000;
+
+// Parses "clamp", "mirror" or "wrap" into border; returns false for anything else
+bool parse_border(const string& name, int& border);
+
+// Returns the column or row of an image of size n that position i, possibly outside it, reads
+int border_index(int i, int n, int border);
+
+// Averages each pixel over the (2 * radius + 1) square around it, with running sums: O(1) per pixel
+Image box_blur(const Image& image, int radius, int border);
+
+/**
+ * Gaussian blur with standard deviation sigma. Up to GAUSSIAN_BOX_SIGMA the
+ * kernel is sampled out to 3 sigma in 14-bit fixed point; beyond it three
+ * successive box blurs approximate the Gaussian at O(1) per pixel. Sigma
+ * is capped at MAX_BLUR_RADIUS / 3; NaN or sigma <= 0 returns the image.
+ */
+Image gaussian_blur(const Image& image, double sigma, int border);
+
+// Sigma above which gaussian_blur uses three box blurs
+const double GAUSSIAN_BOX_SIGMA = 8.0;
+
+// Unsharp mask: adds amount times the difference between the image and its Gaussian blur
+Image unsharp_mask(const Image& image, double sigma, double amount, int border);
+
+// Sobel edges: the gradient magnitude of each channel, from the separable 3x3 Sobel kernels, clamped to 255
+Image sobel_edges(const Image& image, int border);
+
+#endif
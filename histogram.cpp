@@ -0,0 +1,239 @@
+#include "histogram.h"
+#include "parallel.h"
+#include <cstring>
+#include <mutex>
+
+// Pixels counted into the 32-bit tables of add_rows before they are added to the histogram
+const uint64_t FLUSH_PIXELS = (uint64_t)1 << 30;
+
+/**
+ * Counts rows of pixels into the histogram. Alternate pixels go to two
+ * 32-bit tables, so a run of equal pixels does not wait on its own
+ * increments, and the tables are added to the histogram at the end.
+ * @param histogram Receives the counts of the parts it names
+ * @param pixels    The first row
+ * @param stride    Bytes from one row to the next
+ * @param width     Pixels in a row
+ * @param rows      Rows to count
+ */
+void add_rows(Histogram& histogram, const unsigned char* pixels, size_t stride, int width, int rows)
+{
+    bool count_sums = (histogram.parts & HISTOGRAM_SUMS) != 0;
+    bool count_channels = (histogram.parts & HISTOGRAM_CHANNELS) != 0;
+    uint32_t sums[2][MAX_CHANNEL_SUM + 1];
+    uint32_t channels[2][3][256];
+    memset(sums, 0, count_sums ? sizeof(sums) : 0);
+    memset(channels, 0, count_channels ? sizeof(channels) : 0);
+
+    auto flush = [&]() {
+        for (int v = 0; count_sums && v <= MAX_CHANNEL_SUM; v++) {
+            histogram.sums[v] += sums[0][v] + sums[1][v];
+            sums[0][v] = sums[1][v] = 0;
+        }
+        for (int c = 0; count_channels && c < 3; c++) {
+            for (int v = 0; v < 256; v++) {
+                histogram.channels[c][v] += channels[0][c][v] + channels[1][c][v];
+                channels[0][c][v] = channels[1][c][v] = 0;
+            }
+        }
+    };
+    uint64_t pending = 0;
+    for (int y = 0; y < rows; y++) {
+        const unsigned char* row = pixels + stride * y;
+        if (count_sums) {
+            int x = 0;
+            for (; x + 1 < width; x += 2) {
+                sums[0][row[3*x] + row[3*x+1] + row[3*x+2]]++;
+                sums[1][row[3*x+3] + row[3*x+4] + row[3*x+5]]++;
+            }
+            if (x < width) {
+                sums[0][row[3*x] + row[3*x+1] + row[3*x+2]]++;
+            }
+        }
+        if (count_channels) {
+            int x = 0;
+            for (; x + 1 < width; x += 2) {
+                channels[0][0][row[3*x]]++;
+                channels[0][1][row[3*x+1]]++;
+                channels[0][2][row[3*x+2]]++;
+                channels[1][0][row[3*x+3]]++;
+                channels[1][1][row[3*x+4]]++;
+                channels[1][2][row[3*x+5]]++;
+            }
+            if (x < width) {
+                channels[0][0][row[3*x]]++;
+                channels[0][1][row[3*x+1]]++;
+                channels[0][2][row[3*x+2]]++;
+            }
+        }
+        pending += (uint64_t)width;
+        if (pending >= FLUSH_PIXELS) {
+            flush();
+            pending = 0;
+        }
+    }
+    flush();
+    histogram.pixels += (uint64_t)width * rows;
+}
+
+// Histogram of the given parts of rows of pixels, each filter thread counting its own band
+Histogram rows_histogram(const unsigned char* pixels, size_t stride, int width, int height, int parts)
+{
+    Histogram histogram;
+    histogram.parts = parts;
+    mutex merge;
+    parallel_rows(height, stride, [&](int first, int last) {
+        Histogram band;
+        band.parts = parts;
+        add_rows(band, pixels + stride * first, stride, width, last - first);
+        lock_guard<mutex> guard(merge);
+        histogram.pixels += band.pixels;
+        for (int v = 0; v <= MAX_CHANNEL_SUM; v++) {
+            histogram.sums[v] += band.sums[v];
+        }
+        for (int c = 0; c < 3; c++) {
+            for (int v = 0; v < 256; v++) {
+                histogram.channels[c][v] += band.channels[c][v];
+            }
+        }
+    });
+    return histogram;
+}
+
+// Histogram of the given parts of the image
+Histogram image_histogram(const Image& image, int parts)
+{
+    if (image.empty()) {
+        Histogram histogram;
+        histogram.parts = parts;
+        return histogram;
+    }
+    return rows_histogram(image.row(0), image.stride, image.width, image.height, parts);
+}
+
+// Returns the least value whose cumulative count exceeds percent of total, or the largest value counted
+static int percentile(const uint64_t* counts, int values, uint64_t total, double percent)
+{
+    double target = total * (percent / 100);
+    uint64_t cumulative = 0;
+    int largest = 0;
+    for (int v = 0; v < values; v++) {
+        if (counts[v] == 0) {
+            continue;
+        }
+        cumulative += counts[v];
+        largest = v;
+        if (cumulative > target) {
+            return v;
+        }
+    }
+    return largest;
+}
+
+int sum_percentile(const Histogram& histogram, double percent)
+{
+    return percentile(histogram.sums, MAX_CHANNEL_SUM + 1, histogram.pixels, percent);
+}
+
+int channel_percentile(const Histogram& histogram, int channel, double percent)
+{
+    return percentile(histogram.channels[channel], 256, histogram.pixels, percent);
+}
+
+/**
+ * Picks the threshold on the channel average, as highcontrast compares it,
+ * that maximises the variance between the pixels below it and those at or
+ * above it (Otsu's method).
+ * @param histogram A histogram with HISTOGRAM_SUMS
+ * @return The threshold, or 255 / 2 if every pixel has the same average
+ */
+int otsu_threshold(const Histogram& histogram)
+{
+    // Channel averages are the sums divided by three, rounded down, as average_of_three
+    uint64_t averages[256] = {};
+    for (int v = 0; v <= MAX_CHANNEL_SUM; v++) {
+        averages[v / 3] += histogram.sums[v];
+    }
+    double total = 0;
+    double weighted = 0;
+    for (int v = 0; v < 256; v++) {
+        total += averages[v];
+        weighted += (double)v * averages[v];
+    }
+    // Splits anywhere in an empty stretch between the classes score the same; take its middle
+    int first = -1;
+    int last = -1;
+    double best = -1;
+    double dark = 0;
+    double dark_weighted = 0;
+    for (int v = 0; v < 255; v++) {
+        dark += averages[v];
+        dark_weighted += (double)v * averages[v];
+        double light = total - dark;
+        if (dark == 0 || light == 0) {
+            continue;
+        }
+        double difference = dark_weighted / dark - (weighted - dark_weighted) / light;
+        double between = dark * light * difference * difference;
+        if (between > best) {
+            best = between;
+            first = last = v;
+        }
+        else if (between == best) {
+            last = v;
+        }
+    }
+    return first < 0 ? 255 / 2 : (first + last) / 2 + 1;
+}
+
+bool is_adaptive(int userChoice, const FilterParams& params)
+{
+    return userChoice == 20 || ((userChoice == 7 || userChoice == 10) && params.automatic);
+}
+
+int histogram_parts(int userChoice, const FilterParams& params)
+{
+    if (!is_adaptive(userChoice, params)) {
+        return 0;
+    }
+    return userChoice == 20 ? HISTOGRAM_CHANNELS : HISTOGRAM_SUMS;
+}
+
+/**
+ * Sets the parameters of an adaptive processor from the histogram of its input.
+ * @param userChoice The processor; autolevels becomes levels
+ * @param params     Its parameters, which receive the thresholds or points
+ * @param histogram  Histogram of the input, with the histogram_parts of the processor
+ */
+void resolve_adaptive(int& userChoice, FilterParams& params, const Histogram& histogram)
+{
+    if (!is_adaptive(userChoice, params)) {
+        return;
+    }
+    double clip = min(max(params.clip, 0.0), 50.0);
+    if (userChoice == 7) {
+        params.threshold = otsu_threshold(histogram);
+    }
+    else if (userChoice == 10) {
+        int low = sum_percentile(histogram, clip);
+        int high = sum_percentile(histogram, 100 - clip);
+        // A single colour has no range to place the cut-offs in; keep the defaults
+        if (high > low) {
+            FilterParams defaults;
+            params.dark_sum = low + (defaults.dark_sum * (high - low) + MAX_CHANNEL_SUM / 2) / MAX_CHANNEL_SUM;
+            params.light_sum = low + (defaults.light_sum * (high - low) + MAX_CHANNEL_SUM / 2) / MAX_CHANNEL_SUM;
+        }
+    }
+    else {
+        int black = 255;
+        int white = 0;
+        for (int c = 0; c < 3; c++) {
+            black = min(black, channel_percentile(histogram, c, clip));
+            white = max(white, channel_percentile(histogram, c, 100 - clip));
+        }
+        userChoice = 12;
+        params.black_point = black;
+        params.white_point = white;
+    }
+    params.automatic = false;
+}
@@ -0,0 +1,63 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "image.h"
+
+/**
+ * Histograms for the processors that adapt to their input: highcontrast
+ * with an Otsu threshold, bwrgb with cut-offs from percentiles of the
+ * channel sums, and autolevels. Each filter thread counts its own band of
+ * rows and the bands are added together at the end; read_image can instead
+ * count rows as it reads them, while they are still in cache.
+ */
+
+// What a histogram counts
+enum HistogramParts {
+	HISTOGRAM_SUMS = 1,    // pixels by channel sum b + g + r, which also gives the channel averages
+	HISTOGRAM_CHANNELS = 2 // pixels by the value of each channel
+};
+
+// Largest channel sum
+const int MAX_CHANNEL_SUM = 3 * 255;
+
+struct Histogram {
+	int parts = 0; // the HistogramParts counted
+	uint64_t pixels = 0;
+	uint64_t sums[MAX_CHANNEL_SUM + 1] = {};
+	uint64_t channels[3][256] = {}; // blue, green, red
+};
+
+// Counts rows rows of width pixels, stride bytes apart from pixels, into the parts of the histogram
+void add_rows(Histogram& histogram, const unsigned char* pixels, size_t stride, int width, int rows);
+
+// Histogram of the given parts of rows of pixels, counted a band per filter thread
+Histogram rows_histogram(const unsigned char* pixels, size_t stride, int width, int height, int parts);
+
+// Histogram of the given parts of the image, as rows_histogram
+Histogram image_histogram(const Image& image, int parts);
+
+// Returns the least channel sum that more than percent of the pixels do not exceed (the largest if none)
+int sum_percentile(const Histogram& histogram, double percent);
+
+// Returns the least value of the channel that more than percent of the pixels do not exceed (the largest if none)
+int channel_percentile(const Histogram& histogram, int channel, double percent);
+
+// Returns the threshold Otsu's method puts between the dark and light channel averages, or 255 / 2 if there is one class
+int otsu_threshold(const Histogram& histogram);
+
+// Returns whether the processor takes its parameters from a histogram: highcontrast and bwrgb set to auto, and autolevels
+bool is_adaptive(int userChoice, const FilterParams& params);
+
+// Returns the HistogramParts the processor needs, or 0 if it is not adaptive
+int histogram_parts(int userChoice, const FilterParams& params);
+
+/**
+ * Turns an adaptive processor into the fixed one the histogram of its input
+ * calls for: highcontrast gets the Otsu threshold; bwrgb gets cut-offs that
+ * sit between the clip and 100 - clip percentiles of the channel sums where
+ * the defaults sit in 0..765; autolevels becomes levels from the lowest clip
+ * and highest 100 - clip percentiles of the channels.
+ */
+void resolve_adaptive(int& userChoice, FilterParams& params, const Histogram& histogram);
+
+#endif
@@ -1,550 +1,635 @@
-#include "image.h"
-#include <map>
-#include <cmath>
-#include <list>
-#include <iterator>
-/*
- * Sets a value to the char array starting at the offset using the size
- * specified by the bytes.
- * This is a helper function for write_image()
- * @param arr    Array to set values for
- * @param offset Starting index offset
- * @param bytes  Number of bytes to set
- * @param value  Value to set
- */
-void set_bytes(unsigned char arr[], int offset, int bytes, int value) {
-    for (int i = 0; i < bytes; i++) {
-        arr[offset+i] = (unsigned char)(value>>(i*8));
-    }
-}
-
-/** 
- * Write the input image to a BMP file name specified
- * @param filename The BMP file name to save the image to
- * @param image    The input image to save
- * @return True if successful and false otherwise
- */
-bool write_image(string filename, const vector<vector<vector<int> > >& image) {
-    // Get the image width and height in pixels
-    int width_pixels = image[0].size();
-    int height_pixels = image.size();
-
-    // Calculate the width in bytes incorporating padding (4 byte alignment)
-    int width_bytes = width_pixels * 3;
-    int padding_bytes = 0;
-    padding_bytes = (4 - width_bytes % 4) % 4;
-    width_bytes = width_bytes + padding_bytes;
-
-    // Pixel array size in bytes, including padding
-    int array_bytes = width_bytes * height_pixels;
-
-    // Open a file stream for writing to a binary file
-    fstream stream;
-    stream.open(filename, ios::out | ios::binary);
-
-    // If there was a problem opening the file, return false
-    if (!stream.is_open()) {
-        return false;
-    }
-
-    // Create the BMP and DIB Headers
-    const int BMP_HEADER_SIZE = 14;
-    const int DIB_HEADER_SIZE = 40;
-    unsigned char bmp_header[BMP_HEADER_SIZE] = {0};
-    unsigned char dib_header[DIB_HEADER_SIZE] = {0};
-
-    // BMP Header
-    set_bytes(bmp_header,  0, 1, 'B');              // ID field
-    set_bytes(bmp_header,  1, 1, 'M');              // ID field
-    set_bytes(bmp_header,  2, 4, BMP_HEADER_SIZE+DIB_HEADER_SIZE+array_bytes); // Size of BMP file
-    set_bytes(bmp_header,  6, 2, 0);                // Reserved
-    set_bytes(bmp_header,  8, 2, 0);                // Reserved
-    set_bytes(bmp_header, 10, 4, BMP_HEADER_SIZE+DIB_HEADER_SIZE); // Pixel array offset
-
-    // DIB Header
-    set_bytes(dib_header,  0, 4, DIB_HEADER_SIZE);  // DIB header size
-    set_bytes(dib_header,  4, 4, width_pixels);     // Width of bitmap in pixels
-    set_bytes(dib_header,  8, 4, height_pixels);    // Height of bitmap in pixels
-    set_bytes(dib_header, 12, 2, 1);                // Number of color planes
-    set_bytes(dib_header, 14, 2, 24);               // Number of bits per pixel
-    set_bytes(dib_header, 16, 4, 0);                // Compression method (0=BI_RGB)
-    set_bytes(dib_header, 20, 4, array_bytes);      // Size of raw bitmap data (including padding)                     
-    set_bytes(dib_header, 24, 4, 2835);             // Print resolution of image (2835 pixels/meter)
-    set_bytes(dib_header, 28, 4, 2835);             // Print resolution of image (2835 pixels/meter)
-    set_bytes(dib_header, 32, 4, 0);                // Number of colors in palette
-    set_bytes(dib_header, 36, 4, 0);                // Number of important colors
-
-    // Write the BMP and DIB Headers to the file
-    stream.write((char*)bmp_header, sizeof(bmp_header));
-    stream.write((char*)dib_header, sizeof(dib_header));
-
-    // Initialize pixel and padding
-    unsigned char pixel[3] = {0};
-    unsigned char padding[3] = {0};
-
-    // Pixel Array (Left to right, bottom to top, with padding)
-    for (int h = 0; h < height_pixels; h++) {
-        for (int w = 0; w < width_pixels; w++) {
-            // Write the pixel (Blue, Green, Red)
-            pixel[0] = image[h][w][0];
-            pixel[1] = image[h][w][1];
-            pixel[2] = image[h][w][2];
-            stream.write((char*)pixel, 3);
-        }
-        // Write the padding bytes
-        stream.write((char *)padding, padding_bytes);
-    }
-
-    // Close the stream and return true
-    stream.close();
-    return true;
-}
-
-/** 
- * Gets an integer from a binary stream.
- * @param stream the stream
- * @param offset the offset at which to read the integer
- * @return the integer starting at the given offset
- */ 
-int get_int(fstream& stream, int offset)
-{
-    stream.seekg(offset);
-    int result = 0;
-    int base = 1;
-    for (int i = 0; i < 4; i++)
-    {   
-        result = result + stream.get() * base;
-        base = base * 256;
-    }
-    return result;
-}
-
-
-// Adds vignette effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_1(const vector<vector<vector<int> > >& image,int height, int width)
-{
-    int rows = width;
-    int columns = height;
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            double distance = sqrt((pow(w - (width / 2), 2)) + (pow(h - (height / 2), 2)));
-            double scaling_factor = (((height - distance) / height)+((width - distance) / width))/2;
-            new_image[w][h][0] = image[w][h][0] * scaling_factor;
-            new_image[w][h][1] = image[w][h][1] * scaling_factor;
-            new_image[w][h][2] = image[w][h][2] * scaling_factor;
-            //std::cout << distance << " " << scaling_factor << " " << h << " " << w << endl;
-        }
-    }    
-    return new_image;
-}
-
-// Adds claredon effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_2(const vector<vector<vector<int> > >& image, int height, int width)
-{
-    int rows = width;
-    int columns = height;
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    double scaling_factor = 0.3;
-
-    std::cout << "Please enter the scaling factor for the effect: (between 0 and 1)" << endl;
-    std::cin >> scaling_factor;
-    std::cin.clear();
-    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    int newblue=0, newred=0, newgreen=0;
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            
-            int b = image[w][h][0];
-            int g = image[w][h][1];
-            int r = image[w][h][2];
-            double average = (b + g + r) / 3;
-            if (average > 170) {
-                newblue = int(255 - (255 - b) * scaling_factor);
-                newgreen = int(255 - (255 - g) * scaling_factor);
-                newred = int(255 - (255 - r) * scaling_factor);
-            }
-            else if (average < 90) {
-                newblue = b * scaling_factor;
-                newgreen = g * scaling_factor;
-                newred = r * scaling_factor;
-            }
-            else {
-                newblue = b ;
-                newgreen = g ;
-                newred = r ;
-            }
-            new_image[w][h][0] = newblue;
-            new_image[w][h][1] = newgreen;
-            new_image[w][h][2] = newred;
-        }
-    }
-    return new_image;
-}
-
-// Adds grayscale effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_3(const vector<vector<vector<int> > >& image, int height, int width)
-{
-    int rows = width;
-    int columns = height;
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            int b = image[w][h][0];
-            int g = image[w][h][1];
-            int r = image[w][h][2];
-            double average = (b + g + r) / 3;
-            new_image[w][h][0] = average;
-            new_image[w][h][1] = average;
-            new_image[w][h][2] = average;
-        }
-    }
-    return new_image;
-}
-
-// Rotates the input image by 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_4(const vector<vector<vector<int> > >& image, int height, int width)
-{
-    int rows = height;
-    int columns = width;
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            new_image[h][w][0] = image[w][(height-1)-h][0];
-            new_image[h][w][1] = image[w][(height-1)-h][1];
-            new_image[h][w][2] = image[w][(height-1)-h][2];
-        }
-    }
-    return new_image;
-}
-
-// Rotates image by the specified multiple of 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_5(const vector<vector<vector<int> > >& image,  int height, int width)
-{
-    vector<vector<vector<int>>> new_image = image;
-    int rotations = 0;
-    std::cout << "Please enter the number of rotations:" << endl;
-    std::cin >> rotations;
-    std::cin.clear();
-    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    for (int i = 0; i < rotations; i++) {
-        int new_width = new_image.size();
-        int new_height = new_image[0].size();
-        new_image = process_4(new_image,new_height, new_width);
-    }
-    return new_image;
-}
-
-// Enlarges the input image in the x and y direction by the scales specified and returns the resulting image
-vector<vector<vector<int> > > process_6(const vector<vector<vector<int> > >& image,  int height, int width)
-{
-    int x_scale = 0, y_scale = 0;
-    std::cout << "Please enter the x scale factor:" << endl;
-    std::cin >> x_scale ;
-    std::cin.clear();
-    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    std::cout << "Please enter the y scale factor:" << endl;
-    std::cin >> y_scale;
-    std::cin.clear();
-    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    int rows = width*y_scale;
-    int columns = height*x_scale;
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < rows; w++) {
-        for (int h = 0; h < columns; h++) {
-            new_image[w][h][0] = image[w/y_scale][h/x_scale][0] ;
-            new_image[w][h][1] = image[w/y_scale][h/x_scale][1] ;
-            new_image[w][h][2] = image[w/y_scale][h/x_scale][2] ;
-        }
-    }
-    return new_image;
-}
-
-// Converts the input image to high contrast and returns the resulting image
-vector<vector<vector<int> > > process_7(const vector<vector<vector<int> > >& image, int height, int width)
-{
-    int rows = width;
-    int columns = height;
-    int newblue = 0, newred = 0, newgreen = 0;
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            int b = image[w][h][0];
-            int g = image[w][h][1];
-            int r = image[w][h][2];
-            double average = (b + g + r) / 3;
-            if (average >= 255 / 2) {
-                newred = 255;
-                newgreen = 255;
-                newblue = 255;
-            }
-            else {
-                newred = 0;
-                newgreen = 0;
-                newblue = 0;
-            }
-            new_image[w][h][0] = newblue;
-            new_image[w][h][1] = newgreen;
-            new_image[w][h][2] = newred;
-        }
-    }
-    return new_image;
-}
-
-// Lightens the input image and returns the resulting image
-vector<vector<vector<int> > > process_8(const vector<vector<vector<int> > >& image, int height, int width)
-{
-    int rows = width;
-    int columns = height;
-    double scaling_factor = 0.3;
-    std::cout << "Please enter the scaling factor for the effect: (between 0 and 1)" << endl;
-    std::cin >> scaling_factor;
-    std::cin.clear();
-    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            new_image[w][h][0] = int(255 - (255 - image[w][h][0]) * scaling_factor);
-            new_image[w][h][1] = int(255 - (255 - image[w][h][1]) * scaling_factor);
-            new_image[w][h][2] = int(255 - (255 - image[w][h][2]) * scaling_factor);
-        }
-    }
-    return new_image;
-}
-
-
-
-
-// Darkens image the input image and returns the resulting image
-vector<vector<vector<int> > > process_9(const vector<vector<vector<int> > >& image, int height, int width)
-{
-    int rows = width;
-    int columns = height;
-    double scaling_factor = 0.3;
-    std::cout << "Please enter the scaling factor for the effect: (between 0 and 1)" << endl;
-    std::cin >> scaling_factor;
-    std::cin.clear();
-    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            new_image[w][h][0] = image[w][h][0] * scaling_factor;
-            new_image[w][h][1] = image[w][h][1] * scaling_factor;
-            new_image[w][h][2] = image[w][h][2] * scaling_factor;
-        }
-    }
-    return new_image;
-}
-
-// Converts the input image to black, white, red, blue, and green only and returns the resulting image
-vector<vector<vector<int> > > process_10(const vector<vector<vector<int> > >& image, int height, int width)
-{
-    int rows = width;
-    int columns = height;
-    int newblue = 0, newred = 0, newgreen = 0;
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            
-           int b = image[w][h][0];
-           int g = image[w][h][1];
-           int r = image[w][h][2];
-           int sumV = b + g + r;
-           int maxV = maximum(b,g,r);
-
-           if (sumV >= 550) {
-               newred = 255;
-               newgreen = 255;
-               newblue = 255;
-           }
-           else if (sumV <= 150) {
-               newred = 0;
-               newgreen = 0;
-               newblue = 0;
-           }
-           else if (maxV == r) {
-               newred = 255;
-               newgreen = 0;
-               newblue = 0;
-           }
-           else if (maxV == b) {
-               newred = 0;
-               newgreen = 0;
-               newblue = 255;
-           }
-           else {
-               newred = 0;
-               newgreen = 255;
-               newblue = 0;
-           }
-           new_image[w][h][0] = newblue;
-           new_image[w][h][1] = newgreen;
-           new_image[w][h][2] = newred;
-        }
-    }
-
-
-    return new_image;
-}
-
-
-//Calculates Max of three int's (for RGB)
-int maximum(int a, int b, int c){
-    int max = (a < b) ? b : a;
-    return ((max < c) ? c : max);
-}
-
-//Creates a path for the output file
-string createOutputPath(path originalFilePath, string processName) {
-    path path2out;
-    if (originalFilePath.has_parent_path())
-    {
-        path2out = originalFilePath.parent_path();
-        path2out += "\\";
-        path2out += originalFilePath.stem();
-        path2out += "_" + processName;
-        path2out += originalFilePath.extension();
-    }
-    else {
-        path2out = originalFilePath.stem();
-        path2out += "_" + processName;
-        path2out += originalFilePath.extension();
-    }
-    return path2out.string();
-}
-
-//reads in image file and calls image processors
-int readInImageFile(path inputFile, int userChoice, map<int, ImageProcessor> mapOfProcessors) {
-    fstream stream;
-    stream.open(inputFile, ios::in | ios::out | ios::binary);
-    int file_size = get_int(stream, 2);
-    int start = get_int(stream, 10);
-    int height = get_int(stream, 18);
-    int width = get_int(stream, 22);
-
-    int scanline_size = width * 3;
-    int padding = 0;
-    if (scanline_size % 4 != 0) {
-        padding = 4 - scanline_size % 4;
-    }
-
-    if (file_size != start + (scanline_size + padding) * height) {
-        std::cout << "Not a 24-bit true color image file." << endl;
-        return 1;
-    }
-    int rows = width;
-    int columns = height;
-    vector<vector<vector<int>>> image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    int pos = start;
-    for (int w = 0; w < width; w++) {
-        for (int h = 0; h < height; h++) {
-            stream.seekg(pos);
-            image[w][h][0] = stream.get();
-            image[w][h][1] = stream.get();
-            image[w][h][2] = stream.get();
-            pos += 3;
-        }
-    } 
-
-    bool wrImage;
-    path fileOutPath;
-    string tmpStr;
-    std::cin.clear();
-    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
-    vector<vector<vector<int>>> new_image(rows, vector<vector<int> >(columns, vector<int>(3, 0)));
-    switch (userChoice) {
-    case 1:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_1(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!"<<endl <<endl<< endl;
-        break;
-    case 2:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_2(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 3:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_3(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 4:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_4(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 5:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_5(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 6:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_6(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 7:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_7(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 8:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_8(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 9:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_9(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 10:
-        fileOutPath = createOutputPath(inputFile, mapOfProcessors.find(userChoice)->second.name);
-        std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
-        getline(cin, tmpStr);
-        if (tmpStr != "") { fileOutPath = tmpStr; }
-        new_image = process_10(image, height, width);
-        wrImage = write_image(fileOutPath.string(), new_image);
-        std::cout << fileOutPath << "has been created!" << endl << endl << endl;
-        break;
-    case 99:
-        return 2;
-    }
-    return 0;
-}
+#include "image.h"
+#include "kernels.h"
+#include "pipeline.h"
+#include "parallel.h"
+#include "rotate.h"
+#include "resample.h"
+#include "metrics.h"
+#include "indexed_bmp.h"
+#include "convolve.h"
+#include "histogram.h"
+#include <map>
+#include <cmath>
+#include <list>
+#include <iterator>
+/*
+ * Sets a value to the char array starting at the offset using the size
+ * specified by the bytes.
+ * This is a helper function for write_image()
+ * @param arr    Array to set values for
+ * @param offset Starting index offset
+ * @param bytes  Number of bytes to set
+ * @param value  Value to set
+ */
+void set_bytes(unsigned char arr[], int offset, int bytes, int value) {
+    for (int i = 0; i < bytes; i++) {
+        arr[offset+i] = (unsigned char)(value>>(i*8));
+    }
+}
+
+Image::Image() : width(0), height(0), stride(0) {}
+
+Image::Image(int width, int height)
+    : width(width), height(height), stride(((size_t)width * 3 + 3) & ~(size_t)3),
+      pixels(stride * height)
+{
+    // Pooled buffers hold whatever the last image left; every filter writes all the pixels but not the padding
+    size_t scanline_size = (size_t)width * 3;
+    if (scanline_size != stride) {
+        for (int y = 0; y < height; y++) {
+            fill(row(y) + scanline_size, row(y) + stride, 0);
+        }
+    }
+}
+
+const int BMP_HEADER_SIZE = 14;
+const int DIB_HEADER_SIZE = 40;
+
+// Bytes of pixel array read_image reads at a time when it counts a histogram as it goes
+const size_t DECODE_BAND_BYTES = (size_t)256 << 10;
+
+/**
+ * Returns the exact size in bytes of the 24-bit BMP file write_image
+ * produces for an image of the given dimensions.
+ * @param width  Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @return Header plus padded pixel array size in bytes
+ */
+size_t bmp_encoded_size(int width, int height) {
+    size_t width_bytes = ((size_t)width * 3 + 3) & ~(size_t)3;
+    return BMP_HEADER_SIZE + DIB_HEADER_SIZE + width_bytes * height;
+}
+
+/**
+ * Fills in the BMP and DIB headers of a 24-bit BMP file.
+ * @param header BMP_FILE_HEADER_SIZE bytes to write the headers to
+ * @param width  Width of the image in pixels
+ * @param height Height of the image in pixels
+ */
+void encode_bmp_header(unsigned char header[], int width, int height) {
+    // Both size fields are 32 bits wide and wrap for files over 4 GB
+    uint32_t file_size = (uint32_t)bmp_encoded_size(width, height);
+    uint32_t array_bytes = file_size - BMP_HEADER_SIZE - DIB_HEADER_SIZE;
+    unsigned char* bmp_header = header;
+    unsigned char* dib_header = header + BMP_HEADER_SIZE;
+    fill(header, header + BMP_FILE_HEADER_SIZE, 0);
+
+    // BMP Header
+    set_bytes(bmp_header,  0, 1, 'B');              // ID field
+    set_bytes(bmp_header,  1, 1, 'M');              // ID field
+    set_bytes(bmp_header,  2, 4, file_size);        // Size of BMP file
+    set_bytes(bmp_header,  6, 2, 0);                // Reserved
+    set_bytes(bmp_header,  8, 2, 0);                // Reserved
+    set_bytes(bmp_header, 10, 4, BMP_HEADER_SIZE+DIB_HEADER_SIZE); // Pixel array offset
+
+    // DIB Header
+    set_bytes(dib_header,  0, 4, DIB_HEADER_SIZE);  // DIB header size
+    set_bytes(dib_header,  4, 4, width);            // Width of bitmap in pixels
+    set_bytes(dib_header,  8, 4, height);           // Height of bitmap in pixels
+    set_bytes(dib_header, 12, 2, 1);                // Number of color planes
+    set_bytes(dib_header, 14, 2, 24);               // Number of bits per pixel
+    set_bytes(dib_header, 16, 4, 0);                // Compression method (0=BI_RGB)
+    set_bytes(dib_header, 20, 4, array_bytes);      // Size of raw bitmap data (including padding)
+    set_bytes(dib_header, 24, 4, 2835);             // Print resolution of image (2835 pixels/meter)
+    set_bytes(dib_header, 28, 4, 2835);             // Print resolution of image (2835 pixels/meter)
+    set_bytes(dib_header, 32, 4, 0);                // Number of colors in palette
+    set_bytes(dib_header, 36, 4, 0);                // Number of important colors
+}
+
+/**
+ * Encodes the image as a 24-bit BMP file into a caller supplied buffer.
+ * @param image The image to encode
+ * @param out   Buffer of at least bmp_encoded_size(image.width, image.height) bytes
+ * @return The number of bytes written to out
+ */
+size_t encode_image(const Image& image, unsigned char* out) {
+    encode_bmp_header(out, image.width, image.height);
+    // Image rows are already padded scanlines, so the pixel array is the buffer
+    copy(image.pixels.begin(), image.pixels.end(), out + BMP_FILE_HEADER_SIZE);
+    return BMP_FILE_HEADER_SIZE + image.pixels.size();
+}
+
+/** 
+ * Write the input image to a BMP file name specified
+ * @param filename The BMP file name to save the image to
+ * @param image    The input image to save
+ * @return True if successful and false otherwise
+ */
+bool write_image(string filename, const Image& image) {
+    // A failed processor leaves no image, and no file is written for it
+    if (image.empty()) {
+        return false;
+    }
+    // Open a file stream for writing to a binary file
+    remove_output(filename);
+    fstream stream;
+    stream.open(filename, ios::out | ios::binary);
+
+    // If there was a problem opening the file, return false
+    if (!stream.is_open()) {
+        return false;
+    }
+
+    // The headers go out first, then the whole padded pixel array in one write
+    METRICS_SPAN(STAGE_WRITE);
+    METRICS_COUNT(COUNTER_BYTES_WRITTEN, BMP_FILE_HEADER_SIZE + image.pixels.size());
+    unsigned char header[BMP_FILE_HEADER_SIZE];
+    encode_bmp_header(header, image.width, image.height);
+    stream.write((char*)header, sizeof(header));
+    stream.write((const char*)image.pixels.data(), image.pixels.size());
+
+    // Close the stream and return whether every byte made it out
+    stream.close();
+    return !stream.fail();
+}
+
+/**
+ * Removes an existing output before it is written anew. Writing through it
+ * would also change every other link to the file, such as a result cache
+ * entry that --cache-link put there.
+ * @param outputFile The file about to be written
+ */
+void remove_output(const path& outputFile)
+{
+    error_code ec;
+    remove(outputFile, ec);
+}
+
+/** 
+ * Gets an integer from a little-endian byte array.
+ * @param arr    the bytes
+ * @param offset the offset at which to read the integer
+ * @return the integer starting at the given offset
+ */ 
+int get_int(const unsigned char arr[], int offset)
+{
+    unsigned int result = 0;
+    for (int i = 3; i >= 0; i--)
+    {   
+        result = result * 256 + arr[offset + i];
+    }
+    return (int)result;
+}
+
+/**
+ * Parses the headers of a BMP file.
+ * @param header The first BMP_FILE_HEADER_SIZE bytes of the file
+ * @param info   Receives the geometry of the pixel array
+ * @return True if the file is an uncompressed 24-bit BMP and false otherwise
+ */
+bool parse_bmp_header(const unsigned char header[], BmpInfo& info)
+{
+    METRICS_SPAN(STAGE_HEADER);
+    if (header[0] != 'B' || header[1] != 'M') {
+        return false;
+    }
+    unsigned int file_size = (unsigned int)get_int(header, 2);
+    unsigned int start = (unsigned int)get_int(header, 10);
+    int width = get_int(header, 18);
+    int height = get_int(header, 22);
+    int bits_per_pixel = get_int(header, 28) & 0xFFFF;
+    int compression = get_int(header, 30);
+
+    // A negative height marks a top-down pixel array
+    bool top_down = height < 0;
+    if (top_down) {
+        height = -height;
+    }
+    if (width <= 0 || height <= 0 || bits_per_pixel != 24 || compression != 0) {
+        return false;
+    }
+
+    uint64_t scanline_size = (uint64_t)width * 3;
+    uint64_t padding = 0;
+    if (scanline_size % 4 != 0) {
+        padding = 4 - scanline_size % 4;
+    }
+
+    // The size field is only 32 bits, so it wraps for files over 4 GB
+    if (file_size != (unsigned int)(start + (scanline_size + padding) * height)) {
+        return false;
+    }
+    info.width = width;
+    info.height = height;
+    info.top_down = top_down;
+    info.start = start;
+    return true;
+}
+
+// Reads and parses the headers of the BMP file specified
+bool read_bmp_info(string filename, BmpInfo& info)
+{
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    unsigned char header[BMP_FILE_HEADER_SIZE];
+    stream.read((char*)header, sizeof(header));
+    return stream && parse_bmp_header(header, info);
+}
+
+/**
+ * Reads the BMP image specified and returns the resulting image.
+ * The pixel array is read with one bulk read straight into the image buffer
+ * (rows of an Image are BMP scanlines, padding included); top-down files
+ * are read one scanline at a time into the reversed row. Paletted files are
+ * decoded by read_indexed_image. Given a histogram, the pixel array is read
+ * a band at a time instead and each band counted straight after its read,
+ * while it is still in cache.
+ * @param filename  The BMP file to read
+ * @param histogram Receives the counts of the parts it names, or nullptr
+ * @return The image, or an empty image if the file is not a 24-bit or paletted BMP
+ */
+Image read_image(string filename, Histogram* histogram)
+{
+    METRICS_SPAN(STAGE_DECODE);
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    if (!stream.is_open()) {
+        return Image();
+    }
+    unsigned char header[BMP_FILE_HEADER_SIZE];
+    BmpInfo info;
+    stream.read((char*)header, sizeof(header));
+    if (!stream) {
+        return Image();
+    }
+    if (!parse_bmp_header(header, info)) {
+        Image image = read_indexed_image(stream, header);
+        if (histogram != nullptr && !image.empty()) {
+            add_rows(*histogram, image.row(0), image.stride, image.width, image.height);
+        }
+        return image;
+    }
+
+    Image image(info.width, info.height);
+    stream.seekg(info.start);
+    if (histogram == nullptr && !info.top_down) {
+        stream.read((char*)image.pixels.data(), image.pixels.size());
+    }
+    else {
+        int band = (int)max((size_t)1, DECODE_BAND_BYTES / image.stride);
+        for (int y0 = 0; y0 < info.height && stream; y0 += band) {
+            int rows = min(band, info.height - y0);
+            // Top-down files fill the bands from the last row back
+            int first = info.top_down ? info.height - y0 - rows : y0;
+            if (info.top_down) {
+                for (int y = first + rows - 1; y >= first; y--) {
+                    stream.read((char*)image.row(y), image.stride);
+                }
+            }
+            else {
+                stream.read((char*)image.row(first), image.stride * rows);
+            }
+            if (histogram != nullptr) {
+                add_rows(*histogram, image.row(first), image.stride, info.width, rows);
+            }
+        }
+    }
+    if (!stream) {
+        return Image();
+    }
+    METRICS_COUNT(COUNTER_BYTES_READ, BMP_FILE_HEADER_SIZE + image.pixels.size());
+
+    // Padding bytes in the file are not guaranteed to be zero
+    size_t scanline_size = (size_t)info.width * 3;
+    if (scanline_size != image.stride) {
+        for (int y = 0; y < info.height; y++) {
+            fill(image.row(y) + scanline_size, image.row(y) + image.stride, 0);
+        }
+    }
+    return image;
+}
+
+
+// Adds vignette effect to the input image and returns the resulting image
+Image process_1(const Image& image)
+{
+    Image new_image(image.width, image.height);
+    apply_point_filter(image, new_image, 1, FilterParams());
+    return new_image;
+}
+
+// Adds claredon effect to the input image and returns the resulting image
+Image process_2(const Image& image, double scaling_factor)
+{
+    FilterParams params;
+    params.scaling_factor = scaling_factor;
+    Image new_image(image.width, image.height);
+    apply_point_filter(image, new_image, 2, params);
+    return new_image;
+}
+
+// Adds grayscale effect to the input image and returns the resulting image
+Image process_3(const Image& image)
+{
+    Image new_image(image.width, image.height);
+    apply_point_filter(image, new_image, 3, FilterParams());
+    return new_image;
+}
+
+// Rotates the input image by 90 degrees clockwise and returns the resulting image
+Image process_4(const Image& image)
+{
+    return rotate_image(image, 1);
+}
+
+// Rotates image by the specified multiple of 90 degrees clockwise and returns the resulting image
+Image process_5(const Image& image, int number)
+{
+    // One pass whatever the count; four turns are the identity and a negative count turns nothing
+    return rotate_image(image, number > 0 ? number % 4 : 0);
+}
+
+// Enlarges the input image in the x and y direction by the scales specified and returns the resulting image
+Image process_6(const Image& image, int x_scale, int y_scale)
+{
+    if (x_scale < 1 || y_scale < 1 || !scale_fits(image.width, image.height, x_scale, y_scale)) {
+        return Image();
+    }
+    int rows = image.height * y_scale;
+    int columns = image.width * x_scale;
+    Image new_image(columns, rows);
+    parallel_rows(rows, new_image.stride, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            const unsigned char* in = image.row(y / y_scale);
+            unsigned char* out = new_image.row(y);
+            for (int x = 0; x < columns; x++) {
+                const unsigned char* pixel = in + 3 * (x / x_scale);
+                out[3*x]   = pixel[0];
+                out[3*x+1] = pixel[1];
+                out[3*x+2] = pixel[2];
+            }
+        }
+    });
+    return new_image;
+}
+
+// Converts the input image to high contrast and returns the resulting image
+Image process_7(const Image& image, int threshold)
+{
+    FilterParams params;
+    params.threshold = threshold;
+    Image new_image(image.width, image.height);
+    apply_point_filter(image, new_image, 7, params);
+    return new_image;
+}
+
+// Lightens the input image and returns the resulting image
+Image process_8(const Image& image, double scaling_factor)
+{
+    FilterParams params;
+    params.scaling_factor = scaling_factor;
+    Image new_image(image.width, image.height);
+    apply_point_filter(image, new_image, 8, params);
+    return new_image;
+}
+
+// Darkens image the input image and returns the resulting image
+Image process_9(const Image& image, double scaling_factor)
+{
+    FilterParams params;
+    params.scaling_factor = scaling_factor;
+    Image new_image(image.width, image.height);
+    apply_point_filter(image, new_image, 9, params);
+    return new_image;
+}
+
+// Converts the input image to black, white, red, blue, and green only and returns the resulting image
+Image process_10(const Image& image, int dark_sum, int light_sum)
+{
+    FilterParams params;
+    params.dark_sum = dark_sum;
+    params.light_sum = light_sum;
+    Image new_image(image.width, image.height);
+    apply_point_filter(image, new_image, 10, params);
+    return new_image;
+}
+
+// Runs the processor selected by userChoice with the given parameters
+Image apply_processor(const Image& image, int userChoice, const FilterParams& params)
+{
+    if (is_adaptive(userChoice, params)) {
+        int resolved_choice = userChoice;
+        FilterParams resolved = params;
+        resolve_adaptive(resolved_choice, resolved, image_histogram(image, histogram_parts(userChoice, params)));
+        return apply_processor(image, resolved_choice, resolved);
+    }
+    switch (userChoice) {
+    case 1:  return process_1(image);
+    case 2:  return process_2(image, params.scaling_factor);
+    case 3:  return process_3(image);
+    case 4:  return process_4(image);
+    case 5:  return process_5(image, params.rotations);
+    case 6:
+        // Whole scales replicate pixels; fractions and shrinking average the area under each pixel
+        if (is_whole_scale(params.x_scale) && is_whole_scale(params.y_scale)) {
+            return process_6(image, (int)params.x_scale, (int)params.y_scale);
+        }
+        return scale_image(image, params.x_scale, params.y_scale);
+    case 7:  return process_7(image, params.threshold);
+    case 8:  return process_8(image, params.scaling_factor);
+    case 9:  return process_9(image, params.scaling_factor);
+    case 10: return process_10(image, params.dark_sum, params.light_sum);
+    case 16: return box_blur(image, params.radius, params.border);
+    case 17: return gaussian_blur(image, params.sigma, params.border);
+    case 18: return unsharp_mask(image, params.sigma, params.amount, params.border);
+    case 19: return sobel_edges(image, params.border);
+    }
+    if (userChoice == 14 || userChoice == 15) {
+        Image new_image = image;
+        if (userChoice == 14) {
+            flip_horizontal(new_image);
+        }
+        else {
+            flip_vertical(new_image);
+        }
+        return new_image;
+    }
+    if (is_point_filter(userChoice)) {
+        Image new_image(image.width, image.height);
+        apply_point_filter(image, new_image, userChoice, params);
+        return new_image;
+    }
+    return Image();
+}
+
+// Prompts on std::cin for the parameters the selected processor needs
+FilterParams read_filter_params(int userChoice)
+{
+    FilterParams params;
+    switch (userChoice) {
+    case 2:
+    case 8:
+    case 9:
+        std::cout << "Please enter the scaling factor for the effect: (between 0 and 1)" << endl;
+        std::cin >> params.scaling_factor;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    case 5:
+        std::cout << "Please enter the number of rotations:" << endl;
+        std::cin >> params.rotations;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    case 6:
+        std::cout << "Please enter the x scale factor: (below 1 shrinks)" << endl;
+        std::cin >> params.x_scale;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        std::cout << "Please enter the y scale factor: (below 1 shrinks)" << endl;
+        std::cin >> params.y_scale;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    case 11:
+        std::cout << "Please enter the gamma: (above 1 brightens, below 1 darkens)" << endl;
+        std::cin >> params.gamma;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    case 12:
+        std::cout << "Please enter the black point: (0 to 255)" << endl;
+        std::cin >> params.black_point;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        std::cout << "Please enter the white point: (0 to 255)" << endl;
+        std::cin >> params.white_point;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    case 13:
+        std::cout << "Please enter the contrast factor: (above 1 adds contrast, below 1 removes it)" << endl;
+        std::cin >> params.contrast;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    case 16:
+        std::cout << "Please enter the blur radius: (pixels)" << endl;
+        std::cin >> params.radius;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    case 17:
+    case 18:
+        std::cout << "Please enter the blur sigma: (pixels)" << endl;
+        std::cin >> params.sigma;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        if (userChoice == 18) {
+            std::cout << "Please enter the sharpening amount: (1 doubles the detail)" << endl;
+            std::cin >> params.amount;
+            std::cin.clear();
+            std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+        break;
+    case 20:
+        std::cout << "Please enter the percent of pixels to clip at each end: (e.g. 0.5)" << endl;
+        std::cin >> params.clip;
+        std::cin.clear();
+        std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        break;
+    }
+    if (!finite_params(params)) {
+        std::cout << "The parameters must be finite numbers; using the defaults" << endl;
+        return FilterParams();
+    }
+    if (userChoice == 6 && !scale_fits(1, 1, params.x_scale, params.y_scale)) {
+        std::cout << "Those scales make every image too large; using the defaults" << endl;
+        return FilterParams();
+    }
+    return params;
+}
+
+// Returns true if none of the parameters is NaN or infinite
+bool finite_params(const FilterParams& params)
+{
+    return isfinite(params.scaling_factor) && isfinite(params.x_scale) && isfinite(params.y_scale)
+        && isfinite(params.gamma) && isfinite(params.contrast) && isfinite(params.sigma)
+        && isfinite(params.amount) && isfinite(params.clip);
+}
+
+
+//Calculates Max of three int's (for RGB)
+int maximum(int a, int b, int c){
+    int max = (a < b) ? b : a;
+    return ((max < c) ? c : max);
+}
+
+//Builds the table of image processors offered to the user
+map<int, ImageProcessor> build_processors() {
+    map<int, ImageProcessor> mapOfProcessors;
+    mapOfProcessors[1] = ImageProcessor{ "vignette","Adds vignette effect to image (dark corners)" };
+    mapOfProcessors[2] = ImageProcessor{ "claredon","Adds claredon type effect to image - darks darker and lights lighter" };
+    mapOfProcessors[3] = ImageProcessor{ "grayscale","Grayscale image" };
+    mapOfProcessors[4] = ImageProcessor{ "rotate90","Rotates image by 90 degrees clockwise (not counter-clockwise)" };
+    mapOfProcessors[5] = ImageProcessor{ "rotate90x","Rotates image by multiples of 90 degrees clockwise" };
+    mapOfProcessors[6] = ImageProcessor{ "enlarge","Enlarges (or shrinks) the image in the x and y direction" };
+    mapOfProcessors[7] = ImageProcessor{ "highcontrast","Convert image to high contrast - black and white only" };
+    mapOfProcessors[8] = ImageProcessor{ "lighten","Lightens image" };
+    mapOfProcessors[9] = ImageProcessor{ "darken","Darkens image" };
+    mapOfProcessors[10] = ImageProcessor{ "bwrgb","Converts image to only black, white, red, blue, and green" };
+    mapOfProcessors[11] = ImageProcessor{ "gamma","Applies a gamma curve - above 1 brightens, below 1 darkens" };
+    mapOfProcessors[12] = ImageProcessor{ "levels","Stretches the given black and white points to the full range" };
+    mapOfProcessors[13] = ImageProcessor{ "contrast","Scales contrast about mid-gray" };
+    mapOfProcessors[14] = ImageProcessor{ "fliph","Mirrors image left to right" };
+    mapOfProcessors[15] = ImageProcessor{ "flipv","Mirrors image top to bottom" };
+    mapOfProcessors[16] = ImageProcessor{ "blur","Box blur - averages each pixel with those within the radius" };
+    mapOfProcessors[17] = ImageProcessor{ "gaussian","Gaussian blur with the given sigma" };
+    mapOfProcessors[18] = ImageProcessor{ "sharpen","Sharpens image with an unsharp mask" };
+    mapOfProcessors[19] = ImageProcessor{ "edges","Finds edges with the Sobel operator" };
+    mapOfProcessors[20] = ImageProcessor{ "autolevels","Stretches the range the image uses to the full range" };
+    return mapOfProcessors;
+}
+
+//Returns true if userChoice names an image processor
+bool is_processor(int userChoice) {
+    return build_processors().count(userChoice) > 0;
+}
+
+//Creates a path for the output file
+string createOutputPath(path originalFilePath, string processName) {
+    path path2out;
+    if (originalFilePath.has_parent_path())
+    {
+        path2out = originalFilePath.parent_path() / originalFilePath.stem();
+        path2out += "_" + processName;
+        path2out += originalFilePath.extension();
+    }
+    else {
+        path2out = originalFilePath.stem();
+        path2out += "_" + processName;
+        path2out += originalFilePath.extension();
+    }
+    return path2out.string();
+}
+
+//reads in image file and calls image processors
+int readInImageFile(path inputFile, int userChoice, map<int, ImageProcessor> mapOfProcessors) {
+    BmpInfo info;
+    if (!read_bmp_info(inputFile.string(), info) && !read_indexed_bmp_info(inputFile.string(), info)) {
+        std::cout << "Not a 24-bit true color or paletted image file." << endl;
+        return 1;
+    }
+
+    bool wrImage;
+    path fileOutPath;
+    string tmpStr;
+    std::cin.clear();
+    std::cin.ignore(numeric_limits<streamsize>::max(), '\n');
+    if (userChoice == 99) {
+        return 2;
+    }
+    map<int, ImageProcessor>::iterator processor = mapOfProcessors.find(userChoice);
+    if (processor == mapOfProcessors.end()) {
+        return 0;
+    }
+    fileOutPath = createOutputPath(inputFile, processor->second.name);
+    std::cout << "Default output filename: " << fileOutPath << " If you would like to save the file to a different location;" << endl << "Enter a new path now or just hit enter to accept the default: " << endl;
+    getline(cin, tmpStr);
+    if (tmpStr != "") { fileOutPath = tmpStr; }
+    FilterParams params = read_filter_params(userChoice);
+    vector<Operation> operations(1, Operation{ userChoice, params });
+    wrImage = process_file(inputFile, fileOutPath, operations);
+    std::cout << fileOutPath << "has been created!" << endl << endl << endl;
+    return 0;
+}
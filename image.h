@@ -11,6 +11,8 @@
 #include <filesystem>
 #include <vector>
 #include <fstream>
+#include <cstdint>
+#include "buffer_pool.h"
 
 using namespace std;
 using namespace std::filesystem;
@@ -20,6 +22,70 @@ struct ImageProcessor {
 	string description;
 };
 
+/**
+ * Contiguous 8-bit BGR image.
+ * Rows are stored bottom to top (BMP order) and every row is padded to a
+ * 4 byte boundary, so row(y) is byte for byte the BMP scanline y. The pixel
+ * array comes from the buffer pool (see buffer_pool.h), 64-byte aligned.
+ */
+struct Image {
+	int width;
+	int height;
+	size_t stride;
+	PixelBuffer pixels;
+
+	Image();
+	// The padding bytes are zero; the pixel bytes are left for the caller to fill
+	Image(int width, int height);
+
+	// Returns a pointer to the first (blue) byte of row y
+	unsigned char* row(int y) { return pixels.data() + y * stride; }
+	const unsigned char* row(int y) const { return pixels.data() + y * stride; }
+
+	bool empty() const { return width <= 0 || height <= 0; }
+};
+
+// Parameters for the processors that take user input
+struct FilterParams {
+	double scaling_factor = 0.3;
+	int rotations = 0;
+	double x_scale = 1;
+	double y_scale = 1;
+	double gamma = 1.0;
+	int black_point = 0;
+	int white_point = 255;
+	double contrast = 1.0;
+	int radius = 2;
+	double sigma = 2.0;
+	double amount = 1.0;
+	int border = 0; // a BorderMode
+	int threshold = 255 / 2; // highcontrast: channel averages at or above it go white
+	int dark_sum = 150;      // bwrgb: channel sums at or below it go black
+	int light_sum = 550;     // bwrgb: channel sums at or above it go white
+	bool automatic = false;  // highcontrast and bwrgb take the above from a histogram of the image
+	double clip = 0.5;       // percent of the pixels bwrgb and autolevels let past each end
+};
+
+
+// Geometry of the pixel array of a 24-bit BMP file
+struct BmpInfo {
+	int width = 0;
+	int height = 0;
+	bool top_down = false;
+	uint64_t start = 0;
+};
+
+// Size of the BMP plus DIB headers write_image emits
+const int BMP_FILE_HEADER_SIZE = 54;
+
+// Returns the exact size in bytes of the BMP file write_image produces for the given dimensions
+size_t bmp_encoded_size(int width, int height);
+
+// Fills in the BMP_FILE_HEADER_SIZE header bytes of a 24-bit BMP file
+void encode_bmp_header(unsigned char header[], int width, int height);
+
+// Encodes the image as a BMP file into out (bmp_encoded_size bytes) and returns the bytes written
+size_t encode_image(const Image& image, unsigned char* out);
 
 /**
  * Write the input image to a BMP file name specified
@@ -27,40 +93,73 @@ struct ImageProcessor {
  * @param image    The input image to save
  * @return True if successful and false otherwise
  */
-bool write_image(string filename, const vector<vector<vector<int> > >& image);
+bool write_image(string filename, const Image& image);
+
+// Removes an existing output before it is written anew, so other links to the old file (result cache entries) keep their contents
+void remove_output(const path& outputFile);
+
+// Stores the low bytes of value little-endian at arr[offset]
+void set_bytes(unsigned char arr[], int offset, int bytes, int value);
+
+// Returns the little-endian 32-bit integer at arr[offset]
+int get_int(const unsigned char arr[], int offset);
+
+// Parses the first BMP_FILE_HEADER_SIZE bytes of a BMP file; false if it is not an uncompressed 24-bit BMP
+bool parse_bmp_header(const unsigned char header[], BmpInfo& info);
+
+// Reads and parses the headers of the BMP file specified
+bool read_bmp_info(string filename, BmpInfo& info);
 
-// Reads the BMP image specified and returns the resulting image
-vector<vector<vector<int> > > read_image(string filename);
+struct Histogram;
+
+// Reads the BMP image specified, 24-bit or paletted, and returns the resulting image (empty on failure);
+// counts the pixels into histogram, if given, as they are read (see histogram.h)
+Image read_image(string filename, Histogram* histogram = nullptr);
 
 // Adds vignette effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_1(const vector<vector<vector<int> > >& image);
+Image process_1(const Image& image);
 
 // Adds claredon effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_2(const vector<vector<vector<int> > >& image);
+Image process_2(const Image& image, double scaling_factor);
 
 // Adds grayscale effect to the input image and returns the resulting image
-vector<vector<vector<int> > > process_3(const vector<vector<vector<int> > >& image);
+Image process_3(const Image& image);
 
 // Rotates the input image by 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_4(const vector<vector<vector<int> > >& image);
+Image process_4(const Image& image);
 
 // Rotates image by the specified multiple of 90 degrees clockwise and returns the resulting image
-vector<vector<vector<int> > > process_5(const vector<vector<vector<int> > >& image, int number);
+Image process_5(const Image& image, int number);
 
 // Enlarges the input image in the x and y direction by the scales specified and returns the resulting image
-vector<vector<vector<int> > > process_6(const vector<vector<vector<int> > >& image, int x_scale, int y_scale);
+Image process_6(const Image& image, int x_scale, int y_scale);
 
-// Converts the input image to high contrast and returns the resulting image
-vector<vector<vector<int> > > process_7(const vector<vector<vector<int> > >& image);
+// Converts the input image to high contrast, white from the threshold average up, and returns the resulting image
+Image process_7(const Image& image, int threshold);
 
 // Lightens the input image and returns the resulting image
-vector<vector<vector<int> > > process_8(const vector<vector<vector<int> > >& image, double scaling_factor);
+Image process_8(const Image& image, double scaling_factor);
 
 // Darkens image the input image and returns the resulting image
-vector<vector<vector<int> > > process_9(const vector<vector<vector<int> > >& image, double scaling_factor);
+Image process_9(const Image& image, double scaling_factor);
+
+// Converts the input image to black, white, red, blue, and green only, by the channel sum cut-offs, and returns the resulting image
+Image process_10(const Image& image, int dark_sum, int light_sum);
+
+// Runs the processor selected by userChoice with the given parameters
+Image apply_processor(const Image& image, int userChoice, const FilterParams& params);
+
+// Prompts on std::cin for the parameters the selected processor needs
+FilterParams read_filter_params(int userChoice);
+
+// Returns true if none of the parameters is NaN or infinite
+bool finite_params(const FilterParams& params);
+
+//builds the table of image processors offered to the user
+map<int, ImageProcessor> build_processors();
 
-// Converts the input image to black, white, red, blue, and green only and returns the resulting image
-vector<vector<vector<int> > > process_10(const vector<vector<vector<int> > >& image);
+//returns true if userChoice names an image processor
+bool is_processor(int userChoice);
 
 //prepares output file path
 string createOutputPath(path originalFilePath, string processName);
@@ -0,0 +1,540 @@
+#include "indexed_bmp.h"
+#include "parallel.h"
+#include "metrics.h"
+#include <atomic>
+#include <climits>
+
+// Values of the BMP compression field
+const int BI_RGB = 0;
+const int BI_RLE8 = 1;
+const int BI_RLE4 = 2;
+
+// Pixels a byte of RLE data may stand for: a two byte run covers at most 255
+const uint64_t MAX_RLE_PIXELS_PER_BYTE = 128;
+
+static OutputFormat current_format = OUTPUT_AUTO;
+
+// Sets how process_file encodes its results; call before processing
+void set_output_format(OutputFormat format)
+{
+    current_format = format;
+}
+
+// Returns how process_file encodes its results
+OutputFormat output_format()
+{
+    return current_format;
+}
+
+// Parses "auto", "24", "indexed" or "rle"; returns false for anything else
+bool parse_output_format(const string& name, OutputFormat& format)
+{
+    if (name == "auto") {
+        format = OUTPUT_AUTO;
+    }
+    else if (name == "24") {
+        format = OUTPUT_TRUECOLOR;
+    }
+    else if (name == "indexed") {
+        format = OUTPUT_INDEXED;
+    }
+    else if (name == "rle") {
+        format = OUTPUT_INDEXED_RLE;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Returns the only colours the processor can produce, or an empty palette if it is not limited
+vector<uint32_t> processor_palette(int userChoice)
+{
+    switch (userChoice) {
+    case 7:  return { 0x000000, 0xFFFFFF };
+    case 10: return { 0x000000, 0xFFFFFF, 0xFF0000, 0x00FF00, 0x0000FF };
+    }
+    return vector<uint32_t>();
+}
+
+/**
+ * Colour to palette index lookup: an open addressed table four times the
+ * size of the largest palette, so a probe rarely goes past its first slot.
+ */
+class ColorIndex {
+public:
+    ColorIndex() : keys_(1024, EMPTY), values_(1024, 0), count_(0) {}
+
+    // Adds the colour if it is new; returns false once there are more than 256
+    bool add(uint32_t color)
+    {
+        size_t slot = hash(color);
+        while (keys_[slot] != EMPTY) {
+            if (keys_[slot] == color) {
+                return true;
+            }
+            slot = (slot + 1) & 1023;
+        }
+        if (count_ == 256) {
+            return false;
+        }
+        keys_[slot] = color;
+        values_[slot] = (unsigned char)count_++;
+        return true;
+    }
+
+    // Returns the index of the colour, or -1 if it is not in the palette
+    int find(uint32_t color) const
+    {
+        size_t slot = hash(color);
+        while (keys_[slot] != EMPTY) {
+            if (keys_[slot] == color) {
+                return values_[slot];
+            }
+            slot = (slot + 1) & 1023;
+        }
+        return -1;
+    }
+
+private:
+    // Colours are 24 bits, so this never matches one
+    static const uint32_t EMPTY = 0xFFFFFFFF;
+
+    static size_t hash(uint32_t color) { return (color * 2654435761u) >> 22; }
+
+    vector<uint32_t> keys_;
+    vector<unsigned char> values_;
+    int count_;
+};
+
+// Collects the colours of the image into palette; returns false if there are more than 256
+bool detect_palette(const Image& image, vector<uint32_t>& palette)
+{
+    ColorIndex index;
+    palette.clear();
+    uint32_t last = 0xFFFFFFFF;
+    for (int y = 0; y < image.height; y++) {
+        const unsigned char* row = image.row(y);
+        for (int x = 0; x < image.width; x++) {
+            uint32_t color = pack_color(row + 3 * x);
+            if (color == last) {
+                continue;
+            }
+            last = color;
+            if (index.find(color) < 0) {
+                if (!index.add(color)) {
+                    return false;
+                }
+                palette.push_back(color);
+            }
+        }
+    }
+    return true;
+}
+
+// Returns the bytes of one uncompressed row of width pixels at bits per pixel, padded to 4 bytes
+static size_t indexed_row_bytes(int width, int bits)
+{
+    return ((size_t)width * bits + 31) / 32 * 4;
+}
+
+// Looks up the palette index of every pixel of a row; returns false if a colour is missing
+static bool index_row(const unsigned char* row, int width, const ColorIndex& index, unsigned char* indices)
+{
+    uint32_t last = 0xFFFFFFFF;
+    int last_index = 0;
+    for (int x = 0; x < width; x++) {
+        uint32_t color = pack_color(row + 3 * x);
+        if (color != last) {
+            last = color;
+            last_index = index.find(color);
+            if (last_index < 0) {
+                return false;
+            }
+        }
+        indices[x] = (unsigned char)last_index;
+    }
+    return true;
+}
+
+// Packs the indices of a row at 1, 4 or 8 bits per pixel, leftmost pixel in the high bits
+static void pack_row(const unsigned char* indices, int width, int bits, unsigned char* out)
+{
+    if (bits == 8) {
+        copy(indices, indices + width, out);
+        return;
+    }
+    int per_byte = 8 / bits;
+    for (int x = 0; x < width; x += per_byte) {
+        unsigned char byte = 0;
+        for (int i = 0; i < per_byte; i++) {
+            byte <<= bits;
+            if (x + i < width) {
+                byte |= indices[x + i];
+            }
+        }
+        out[x / per_byte] = byte;
+    }
+}
+
+/**
+ * Run length encodes a row of indices as BI_RLE8 (bits 8) or BI_RLE4 (bits 4).
+ * Runs of two or more repeat one index; stretches without runs go out in
+ * absolute mode when they are at least three pixels long.
+ */
+static void encode_rle_row(const unsigned char* indices, int width, int bits, vector<unsigned char>& out)
+{
+    int x = 0;
+    while (x < width) {
+        int run = 1;
+        while (x + run < width && run < 255 && indices[x + run] == indices[x]) {
+            run++;
+        }
+        if (run >= 2) {
+            out.push_back((unsigned char)run);
+            out.push_back(bits == 8 ? indices[x] : (unsigned char)(indices[x] << 4 | indices[x]));
+            x += run;
+            continue;
+        }
+        // A literal stretch ends where the next run begins
+        int end = x + 1;
+        while (end < width && end - x < 255 && !(end + 1 < width && indices[end] == indices[end + 1])) {
+            end++;
+        }
+        int count = end - x;
+        if (count < 3) {
+            // Absolute mode needs at least three; one or two pixels fit in a single encoded pair
+            if (bits == 8) {
+                for (int i = x; i < end; i++) {
+                    out.push_back(1);
+                    out.push_back(indices[i]);
+                }
+            }
+            else {
+                out.push_back((unsigned char)count);
+                out.push_back((unsigned char)(indices[x] << 4 | (count == 2 ? indices[x + 1] : 0)));
+            }
+        }
+        else {
+            out.push_back(0);
+            out.push_back((unsigned char)count);
+            size_t bytes = 0;
+            if (bits == 8) {
+                out.insert(out.end(), indices + x, indices + end);
+                bytes = count;
+            }
+            else {
+                for (int i = x; i < end; i += 2) {
+                    out.push_back((unsigned char)(indices[i] << 4 | (i + 1 < end ? indices[i + 1] : 0)));
+                }
+                bytes = (count + 1) / 2;
+            }
+            // Absolute runs end on a 16-bit boundary
+            if (bytes % 2 == 1) {
+                out.push_back(0);
+            }
+        }
+        x = end;
+    }
+}
+
+// Fills in the headers and palette of a paletted BMP file
+static void encode_indexed_header(unsigned char header[], int width, int height, int bits, int compression, const vector<uint32_t>& palette, size_t array_bytes)
+{
+    size_t palette_bytes = 4 * palette.size();
+    encode_bmp_header(header, width, height);
+    set_bytes(header,  2, 4, (int)(uint32_t)(BMP_FILE_HEADER_SIZE + palette_bytes + array_bytes)); // Size of BMP file
+    set_bytes(header, 10, 4, (int)(BMP_FILE_HEADER_SIZE + palette_bytes)); // Pixel array offset
+    set_bytes(header, 28, 2, bits);                          // Number of bits per pixel
+    set_bytes(header, 30, 4, compression);                   // Compression method
+    set_bytes(header, 34, 4, (int)(uint32_t)array_bytes);    // Size of raw bitmap data
+    set_bytes(header, 46, 4, (int)palette.size());           // Number of colors in palette
+    set_bytes(header, 50, 4, 0);                             // Number of important colors
+    unsigned char* entry = header + BMP_FILE_HEADER_SIZE;
+    for (size_t i = 0; i < palette.size(); i++) {
+        set_bytes(entry, 4 * (int)i, 4, (int)palette[i]);    // Blue, green, red, reserved
+    }
+}
+
+/**
+ * Writes the image as a paletted BMP file.
+ * @param filename The BMP file name to save the image to
+ * @param image    The image to write
+ * @param palette  The colours of the image (see pack_color), or empty
+ * @param rle      Whether to run length encode 4 and 8 bit output, when that is smaller
+ * @return True if successful and false otherwise
+ */
+bool write_indexed_image(string filename, const Image& image, vector<uint32_t> palette, bool rle)
+{
+    if (image.empty()) {
+        return false;
+    }
+    ColorIndex index;
+    for (size_t i = 0; i < palette.size() && i < 256; i++) {
+        index.add(palette[i]);
+    }
+    int width = image.width;
+    int height = image.height;
+
+    // A palette from the processor is checked as the rows are indexed; a wrong one means detecting
+    bool detected = palette.empty();
+    if (detected || palette.size() > 256) {
+        if (!detect_palette(image, palette)) {
+            return write_image(filename, image);
+        }
+        index = ColorIndex();
+        for (size_t i = 0; i < palette.size(); i++) {
+            index.add(palette[i]);
+        }
+        detected = true;
+    }
+    int bits = palette.size() <= 2 ? 1 : palette.size() <= 16 ? 4 : 8;
+    int compression = BI_RGB;
+    if (rle && bits > 1) {
+        compression = bits == 8 ? BI_RLE8 : BI_RLE4;
+    }
+
+    vector<unsigned char> array;
+    atomic<bool> missing(false);
+    size_t row_bytes = indexed_row_bytes(width, bits);
+    if (compression != BI_RGB) {
+        vector<unsigned char> indices(width);
+        for (int y = 0; y < height && !missing; y++) {
+            if (!index_row(image.row(y), width, index, indices.data())) {
+                missing = true;
+            }
+            encode_rle_row(indices.data(), width, bits, array);
+            // End of line, or of the bitmap after the last line
+            array.push_back(0);
+            array.push_back(y + 1 < height ? 0 : 1);
+            // Noisy images encode larger than they pack; those are left uncompressed
+            if (array.size() > row_bytes * height) {
+                compression = BI_RGB;
+                break;
+            }
+        }
+    }
+    if (compression == BI_RGB && !missing) {
+        array.assign(row_bytes * height, 0);
+        parallel_rows(height, image.stride, [&](int first, int last) {
+            vector<unsigned char> indices(width);
+            for (int y = first; y < last && !missing; y++) {
+                if (!index_row(image.row(y), width, index, indices.data())) {
+                    missing = true;
+                }
+                pack_row(indices.data(), width, bits, array.data() + row_bytes * y);
+            }
+        });
+    }
+    if (missing) {
+        return detected ? write_image(filename, image) : write_indexed_image(filename, image, vector<uint32_t>(), rle);
+    }
+
+    METRICS_SPAN(STAGE_WRITE);
+    vector<unsigned char> header(BMP_FILE_HEADER_SIZE + 4 * palette.size());
+    encode_indexed_header(header.data(), width, height, bits, compression, palette, array.size());
+    METRICS_COUNT(COUNTER_BYTES_WRITTEN, header.size() + array.size());
+    remove_output(filename);
+    fstream stream;
+    stream.open(filename, ios::out | ios::binary);
+    if (!stream.is_open()) {
+        return false;
+    }
+    stream.write((const char*)header.data(), header.size());
+    stream.write((const char*)array.data(), array.size());
+    stream.close();
+    return !stream.fail();
+}
+
+// Parses the headers of a paletted BMP file (1, 4 or 8 bits, uncompressed, RLE8 or RLE4)
+bool parse_indexed_bmp_header(const unsigned char header[], BmpInfo& info)
+{
+    METRICS_SPAN(STAGE_HEADER);
+    if (header[0] != 'B' || header[1] != 'M') {
+        return false;
+    }
+    unsigned int start = (unsigned int)get_int(header, 10);
+    int dib_size = get_int(header, 14);
+    int width = get_int(header, 18);
+    int height = get_int(header, 22);
+    int bits = get_int(header, 28) & 0xFFFF;
+    int compression = get_int(header, 30);
+    bool valid_compression = compression == BI_RGB
+        || (compression == BI_RLE8 && bits == 8)
+        || (compression == BI_RLE4 && bits == 4);
+    if (dib_size < 40 || width <= 0 || height == 0 || height == INT_MIN || (bits != 1 && bits != 4 && bits != 8) || !valid_compression) {
+        return false;
+    }
+    // Compressed bitmaps are always bottom-up
+    bool top_down = height < 0;
+    if (top_down && compression != BI_RGB) {
+        return false;
+    }
+    info.width = width;
+    info.height = top_down ? -height : height;
+    info.top_down = top_down;
+    info.start = start;
+    return true;
+}
+
+// Reads and parses the headers of the paletted BMP file specified
+bool read_indexed_bmp_info(string filename, BmpInfo& info)
+{
+    fstream stream;
+    stream.open(filename, ios::in | ios::binary);
+    unsigned char header[BMP_FILE_HEADER_SIZE];
+    stream.read((char*)header, sizeof(header));
+    return stream && parse_indexed_bmp_header(header, info);
+}
+
+// Writes palette entry index of the palette into pixel, black if the index is out of range
+static inline void put_color(unsigned char* pixel, const vector<uint32_t>& palette, int index)
+{
+    uint32_t color = (size_t)index < palette.size() ? palette[index] : 0;
+    pixel[0] = (unsigned char)color;
+    pixel[1] = (unsigned char)(color >> 8);
+    pixel[2] = (unsigned char)(color >> 16);
+}
+
+// Decodes BI_RLE8 (bits 8) or BI_RLE4 (bits 4) data; pixels it skips keep their colour
+static void decode_rle(const vector<unsigned char>& data, int bits, const vector<uint32_t>& palette, Image& image)
+{
+    int x = 0;
+    int y = 0;
+    size_t p = 0;
+    while (p + 1 < data.size() && y < image.height) {
+        int count = data[p];
+        int value = data[p + 1];
+        p += 2;
+        if (count > 0) {
+            // Encoded mode: count pixels of one index, or of two alternating nibbles
+            for (int i = 0; i < count && x < image.width; i++, x++) {
+                int index = bits == 8 ? value : (i % 2 == 0 ? value >> 4 : value & 15);
+                put_color(image.row(y) + 3 * x, palette, index);
+            }
+        }
+        else if (value == 0) {
+            x = 0;
+            y++;
+        }
+        else if (value == 1) {
+            break;
+        }
+        else if (value == 2) {
+            if (p + 1 >= data.size()) {
+                break;
+            }
+            x += data[p];
+            y += data[p + 1];
+            p += 2;
+        }
+        else {
+            // Absolute mode: value indices follow, padded to 16 bits
+            size_t bytes = bits == 8 ? value : (value + 1) / 2;
+            for (int i = 0; i < value && p + (bits == 8 ? i : i / 2) < data.size(); i++) {
+                int byte = data[p + (bits == 8 ? i : i / 2)];
+                int index = bits == 8 ? byte : (i % 2 == 0 ? byte >> 4 : byte & 15);
+                if (x < image.width) {
+                    put_color(image.row(y) + 3 * x, palette, index);
+                }
+                x++;
+            }
+            p += bytes + bytes % 2;
+        }
+    }
+}
+
+/**
+ * Decodes a paletted BMP file whose header has already been read.
+ * @param stream The file, positioned after the header
+ * @param header The first BMP_FILE_HEADER_SIZE bytes of the file
+ * @return The image, or an empty image if the file is not a valid paletted BMP
+ */
+Image read_indexed_image(istream& stream, const unsigned char header[])
+{
+    METRICS_SPAN(STAGE_DECODE);
+    BmpInfo info;
+    if (!parse_indexed_bmp_header(header, info)) {
+        return Image();
+    }
+    int dib_size = get_int(header, 14);
+    int bits = get_int(header, 28) & 0xFFFF;
+    int compression = get_int(header, 30);
+    uint32_t array_bytes = (uint32_t)get_int(header, 34);
+    int colors = get_int(header, 46);
+    if (colors <= 0 || colors > (1 << bits)) {
+        colors = 1 << bits;
+    }
+
+    // The palette follows the DIB header: blue, green, red, reserved
+    vector<unsigned char> entries(4 * (size_t)colors);
+    stream.seekg(14 + dib_size);
+    stream.read((char*)entries.data(), entries.size());
+    if (!stream) {
+        return Image();
+    }
+    vector<uint32_t> palette(colors);
+    for (int i = 0; i < colors; i++) {
+        palette[i] = get_int(entries.data(), 4 * i) & 0xFFFFFF;
+    }
+
+    // The header sizes come from the file, so check them against its length before allocating
+    stream.seekg(0, ios::end);
+    uint64_t file_bytes = (uint64_t)stream.tellg();
+    if (!stream || info.start > file_bytes) {
+        return Image();
+    }
+    uint64_t pixel_bytes = file_bytes - info.start;
+    uint64_t row_bytes = indexed_row_bytes(info.width, bits);
+    if (compression == BI_RGB && row_bytes * info.height > pixel_bytes) {
+        return Image();
+    }
+    if (compression != BI_RGB && (uint64_t)info.width * info.height > pixel_bytes * MAX_RLE_PIXELS_PER_BYTE) {
+        return Image();
+    }
+    vector<unsigned char> data;
+    stream.seekg(info.start);
+    if (compression == BI_RGB) {
+        data.resize(row_bytes * info.height);
+        stream.read((char*)data.data(), data.size());
+        if (!stream) {
+            return Image();
+        }
+    }
+    else {
+        // The size field is optional for RLE; without it read to the end of the file
+        if (array_bytes > 0) {
+            data.resize(min((uint64_t)array_bytes, pixel_bytes));
+            stream.read((char*)data.data(), data.size());
+            data.resize((size_t)stream.gcount());
+        }
+        else {
+            data.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+        }
+    }
+    METRICS_COUNT(COUNTER_BYTES_READ, 14 + dib_size + entries.size() + data.size());
+
+    Image image(info.width, info.height);
+    if (compression == BI_RGB) {
+        parallel_rows(info.height, image.stride, [&](int first, int last) {
+            for (int y = first; y < last; y++) {
+                const unsigned char* in = data.data() + row_bytes * (info.top_down ? info.height - 1 - y : y);
+                unsigned char* out = image.row(y);
+                for (int x = 0; x < info.width; x++) {
+                    int index = in[(size_t)x * bits / 8] >> (8 - bits - (x * bits) % 8) & ((1 << bits) - 1);
+                    put_color(out + 3 * x, palette, index);
+                }
+            }
+        });
+    }
+    else {
+        // Pixels the encoder skipped take the first palette colour
+        for (int y = 0; y < info.height; y++) {
+            for (int x = 0; x < info.width; x++) {
+                put_color(image.row(y) + 3 * x, palette, 0);
+            }
+        }
+        decode_rle(data, bits, palette, image);
+    }
+    return image;
+}
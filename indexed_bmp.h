@@ -0,0 +1,68 @@
+#ifndef INDEXED_BMP_H
+#define INDEXED_BMP_H
+
+#include "image.h"
+#include <istream>
+
+/**
+ * Paletted BMP files: 1, 4 and 8 bits per pixel, uncompressed or run length
+ * encoded (BI_RLE8 for 8 bits, BI_RLE4 for 4 bits). An image with at most
+ * 256 colours is written with the smallest depth its palette fits in, which
+ * for the black and white output of highcontrast is 1/24 of the 24-bit size.
+ * read_image decodes these files back to 24-bit images.
+ */
+
+// How process_file encodes its results
+enum OutputFormat {
+	OUTPUT_AUTO,        // paletted for recipes ending in highcontrast or bwrgb, 24-bit otherwise
+	OUTPUT_TRUECOLOR,   // always 24-bit
+	OUTPUT_INDEXED,     // paletted whenever the result has at most 256 colours
+	OUTPUT_INDEXED_RLE  // as OUTPUT_INDEXED, run length encoded at 4 and 8 bits
+};
+
+// Sets how process_file encodes its results; call before processing
+void set_output_format(OutputFormat format);
+
+// Returns how process_file encodes its results
+OutputFormat output_format();
+
+// Parses "auto", "24", "indexed" or "rle"; returns false for anything else
+bool parse_output_format(const string& name, OutputFormat& format);
+
+// Packs a colour as stored in the palette: blue in the low byte, then green, then red
+inline uint32_t pack_color(const unsigned char* pixel) {
+	return pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+}
+
+// Returns the only colours the processor can produce, or an empty palette if it is not limited
+vector<uint32_t> processor_palette(int userChoice);
+
+// Collects the colours of the image into palette; returns false if there are more than 256
+bool detect_palette(const Image& image, vector<uint32_t>& palette);
+
+/**
+ * Writes the image as a paletted BMP file. An empty palette is detected from
+ * the image; an image with more than 256 colours, or with colours missing
+ * from the palette it was given, is written by write_image instead.
+ * @param filename The BMP file name to save the image to
+ * @param image    The image to write
+ * @param palette  The colours of the image (see pack_color), or empty
+ * @param rle      Whether to run length encode 4 and 8 bit output, when that is smaller
+ * @return True if successful and false otherwise
+ */
+bool write_indexed_image(string filename, const Image& image, vector<uint32_t> palette, bool rle);
+
+// Parses the headers of a paletted BMP file (1, 4 or 8 bits, uncompressed, RLE8 or RLE4)
+bool parse_indexed_bmp_header(const unsigned char header[], BmpInfo& info);
+
+// Reads and parses the headers of the paletted BMP file specified
+bool read_indexed_bmp_info(string filename, BmpInfo& info);
+
+/**
+ * Decodes a paletted BMP file whose first BMP_FILE_HEADER_SIZE bytes,
+ * already read from stream, are header.
+ * @return The image, or an empty image if the file is not a valid paletted BMP
+ */
+Image read_indexed_image(istream& stream, const unsigned char header[]);
+
+#endif
@@ -0,0 +1,325 @@
+#include "io_pipeline.h"
+#include "parallel.h"
+#include "view.h"
+#include "result_cache.h"
+#include "histogram.h"
+#include "metrics.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#ifdef IMAGE_IO_URING
+#include <liburing.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// A file on its way through the pipeline
+struct PipelineJob {
+    path inputFile;
+    path outputFile;
+    Image image;
+    Image storage;
+    ImageView view;
+    Histogram histogram;  // counted while decoding, for an adaptive first processor
+    string key;           // of the result, when the result cache is open
+    bool fetched = false; // the result came from the cache
+    unique_ptr<ImageMetrics> metrics; // of the file, between stages (see metrics.h)
+};
+
+typedef unique_ptr<PipelineJob> JobPointer;
+
+// Counts of a pipeline run
+struct PipelineCounts {
+    atomic<int> processed{ 0 };
+    atomic<int> failed{ 0 };
+    mutex report;
+};
+
+// Counts the file as failed and says so
+static void report_failure(PipelineCounts& counts, const path& inputFile)
+{
+    counts.failed++;
+    lock_guard<mutex> guard(counts.report);
+    std::cerr << "Could not process " << inputFile.string() << endl;
+}
+
+// Hands the metrics of the job this thread is done with to the job, for its next stage
+static void suspend_metrics(PipelineJob& job)
+{
+    job.metrics.reset(METRICS_SUSPEND_IMAGE());
+}
+
+// Carries on recording the metrics of the job on this thread
+static void resume_metrics(PipelineJob& job)
+{
+    METRICS_RESUME_IMAGE(job.metrics.release());
+}
+
+// Returns a job for the file with nothing read yet
+static JobPointer make_job(const path& inputFile, const BatchOptions& options)
+{
+    JobPointer job(new PipelineJob());
+    job->inputFile = inputFile;
+    job->outputFile = batch_output_path(inputFile, options);
+    return job;
+}
+
+// Decodes the files in order, blocking while options.prefetch of them wait for a filter thread
+static void read_files(const vector<path>& files, const BatchOptions& options, BoundedQueue<JobPointer>& decoded, PipelineCounts& counts)
+{
+    for (size_t i = 0; i < files.size(); i++) {
+        JobPointer job = make_job(files[i], options);
+        METRICS_BEGIN_IMAGE();
+        job->histogram.parts = input_histogram_parts(options.operations);
+        job->image = read_image(files[i].string(), job->histogram.parts != 0 ? &job->histogram : nullptr);
+        if (job->image.empty()) {
+            METRICS_END_IMAGE(files[i], false);
+            report_failure(counts, files[i]);
+            continue;
+        }
+        suspend_metrics(*job);
+        if (!decoded.push(move(job))) {
+            return;
+        }
+    }
+}
+
+#ifdef IMAGE_IO_URING
+
+// Most bytes asked of a single read; a read's length is 32 bits and Linux stops short of 2 GB anyway
+const size_t MAX_URING_READ = (size_t)1 << 30;
+
+// Jobs whose reads were in flight when the ring failed; the kernel may still write into them, so they are never freed
+static mutex abandoned_lock;
+static vector<JobPointer> abandoned;
+
+/**
+ * Decodes the files a prefetch window at a time: the headers are read
+ * directly, then the pixel arrays of the whole window are read through one
+ * io_uring submission, straight into the image buffers, a gigabyte at most
+ * per request. Top-down files are left to read_image. Every read of a
+ * window completes before its buffers and files are let go; if the ring
+ * itself fails, the buffers still being read into are never freed and the
+ * remaining files are left to read_files.
+ */
+static void read_files_uring(const vector<path>& files, const BatchOptions& options, BoundedQueue<JobPointer>& decoded, PipelineCounts& counts)
+{
+    unsigned depth = (unsigned)max(options.prefetch, 1);
+    struct io_uring ring;
+    if (io_uring_queue_init(depth, &ring, 0) < 0) {
+        read_files(files, options, decoded, counts);
+        return;
+    }
+    int parts = input_histogram_parts(options.operations);
+    for (size_t first = 0; first < files.size(); first += depth) {
+        size_t count = min(files.size() - first, (size_t)depth);
+        vector<JobPointer> window(count);
+        vector<int> fds(count, -1);
+        vector<uint64_t> starts(count, 0);
+        vector<size_t> done(count, 0);
+        vector<bool> ok(count, false);
+        vector<bool> in_flight(count, false);
+        unsigned outstanding = 0;
+        // Queues a read of the rest of the pixel array of file i, up to MAX_URING_READ bytes
+        auto queue_read = [&](size_t i) {
+            PixelBuffer& pixels = window[i]->image.pixels;
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+            size_t length = min(pixels.size() - done[i], MAX_URING_READ);
+            io_uring_prep_read(sqe, fds[i], pixels.data() + done[i], (unsigned)length, starts[i] + done[i]);
+            io_uring_sqe_set_data(sqe, (void*)i);
+            in_flight[i] = true;
+            outstanding++;
+        };
+        for (size_t i = 0; i < count; i++) {
+            const path& inputFile = files[first + i];
+            window[i] = make_job(inputFile, options);
+            window[i]->histogram.parts = parts;
+            METRICS_BEGIN_IMAGE();
+            unsigned char header[BMP_FILE_HEADER_SIZE];
+            BmpInfo info;
+            fds[i] = open(inputFile.c_str(), O_RDONLY);
+            if (fds[i] < 0 || pread(fds[i], header, sizeof(header), 0) != (ssize_t)sizeof(header)
+                || !parse_bmp_header(header, info) || info.top_down) {
+                window[i]->image = read_image(inputFile.string(), parts != 0 ? &window[i]->histogram : nullptr);
+                ok[i] = !window[i]->image.empty();
+                suspend_metrics(*window[i]);
+                continue;
+            }
+            window[i]->image = Image(info.width, info.height);
+            starts[i] = info.start;
+            METRICS_COUNT(COUNTER_BYTES_READ, BMP_FILE_HEADER_SIZE + window[i]->image.pixels.size());
+            suspend_metrics(*window[i]);
+            queue_read(i);
+        }
+        bool broken = false;
+        while (outstanding > 0 && !broken) {
+            int submitted = io_uring_submit(&ring);
+            if (submitted == -EINTR || submitted == -EAGAIN) {
+                continue;
+            }
+            struct io_uring_cqe* cqe;
+            int waited = submitted < 0 ? submitted : io_uring_wait_cqe(&ring, &cqe);
+            if (waited == -EINTR || waited == -EAGAIN) {
+                continue;
+            }
+            if (waited < 0) {
+                broken = true;
+                break;
+            }
+            size_t i = (size_t)io_uring_cqe_get_data(cqe);
+            int result = cqe->res;
+            io_uring_cqe_seen(&ring, cqe);
+            in_flight[i] = false;
+            outstanding--;
+            if (result == -EINTR || result == -EAGAIN) {
+                queue_read(i);
+                continue;
+            }
+            if (result <= 0) {
+                continue;
+            }
+            Image& image = window[i]->image;
+            done[i] += (size_t)result;
+            if (done[i] < image.pixels.size()) {
+                // Short or capped read: ask for the rest
+                queue_read(i);
+                continue;
+            }
+            // Padding bytes in the file are not guaranteed to be zero
+            size_t scanline_size = (size_t)image.width * 3;
+            for (int y = 0; y < image.height && scanline_size != image.stride; y++) {
+                fill(image.row(y) + scanline_size, image.row(y) + image.stride, 0);
+            }
+            // Counted here rather than band by band, since the read lands all at once
+            if (parts != 0) {
+                add_rows(window[i]->histogram, image.row(0), image.stride, image.width, image.height);
+            }
+            ok[i] = true;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+            if (in_flight[i] || !ok[i]) {
+                resume_metrics(*window[i]);
+                METRICS_END_IMAGE(files[first + i], false);
+                report_failure(counts, files[first + i]);
+                if (in_flight[i]) {
+                    lock_guard<mutex> guard(abandoned_lock);
+                    abandoned.push_back(move(window[i]));
+                }
+            }
+            else if (!decoded.push(move(window[i]))) {
+                io_uring_queue_exit(&ring);
+                return;
+            }
+        }
+        if (broken) {
+            // The ring cannot be waited on, so it is not torn down either
+            vector<path> rest(files.begin() + first + count, files.end());
+            read_files(rest, options, decoded, counts);
+            return;
+        }
+    }
+    io_uring_queue_exit(&ring);
+}
+
+#endif
+
+// Runs the operations on decoded images until the reader is done, leaving trailing geometry to the writer
+static void filter_files(const BatchOptions& options, BoundedQueue<JobPointer>& decoded, BoundedQueue<JobPointer>& filtered)
+{
+    JobPointer job;
+    while (decoded.pop(job)) {
+        resume_metrics(*job);
+        if (result_cache_enabled()) {
+            job->key = result_key(job->image, options.operations);
+            job->fetched = fetch_result(job->key, job->outputFile);
+        }
+        if (!job->fetched) {
+            job->view = run_pipeline_view(job->image, options.operations, job->storage, &job->histogram);
+        }
+        if (job->view.source != &job->image) {
+            // Only the result is needed from here on, if anything
+            job->image = Image();
+        }
+        suspend_metrics(*job);
+        if (!filtered.push(move(job))) {
+            return;
+        }
+    }
+}
+
+// Writes the filtered images as they come
+static void write_files(BoundedQueue<JobPointer>& filtered, const BatchOptions& options, PipelineCounts& counts)
+{
+    JobPointer job;
+    while (filtered.pop(job)) {
+        resume_metrics(*job);
+        bool written = job->fetched;
+        if (!written) {
+            written = write_result(job->outputFile.string(), job->view, options.operations);
+            if (written && !job->key.empty()) {
+                store_result(job->key, job->outputFile);
+            }
+        }
+        METRICS_END_IMAGE(job->inputFile, written);
+        if (written) {
+            counts.processed++;
+        }
+        else {
+            report_failure(counts, job->inputFile);
+        }
+        job.reset();
+    }
+}
+
+/**
+ * Processes the files as a read, filter and write pipeline.
+ * @param files   The BMP files to process
+ * @param options The operations to run, the threads and the prefetch depth
+ * @return How many files were processed and how many failed
+ */
+BatchSummary run_io_pipeline(const vector<path>& files, const BatchOptions& options)
+{
+    BatchSummary summary;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    PipelineCounts counts;
+    CacheStats before = result_cache_stats();
+    set_filter_threads(options.imageThreads);
+
+    size_t depth = (size_t)max(options.prefetch, 1);
+    BoundedQueue<JobPointer> decoded(depth);
+    BoundedQueue<JobPointer> filtered(depth);
+    int filter_count = options.threads > 0 ? options.threads : (int)max(thread::hardware_concurrency(), 1u);
+
+#ifdef IMAGE_IO_URING
+    thread reader(read_files_uring, cref(files), cref(options), ref(decoded), ref(counts));
+#else
+    thread reader(read_files, cref(files), cref(options), ref(decoded), ref(counts));
+#endif
+    vector<thread> filters;
+    for (int i = 0; i < filter_count; i++) {
+        filters.push_back(thread(filter_files, cref(options), ref(decoded), ref(filtered)));
+    }
+    thread writer(write_files, ref(filtered), cref(options), ref(counts));
+
+    reader.join();
+    decoded.close();
+    for (size_t i = 0; i < filters.size(); i++) {
+        filters[i].join();
+    }
+    filtered.close();
+    writer.join();
+
+    summary.processed = counts.processed;
+    summary.failed = counts.failed;
+    summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    CacheStats after = result_cache_stats();
+    summary.cacheHits = after.hits - before.hits;
+    summary.cacheMisses = after.misses - before.misses;
+    return summary;
+}
@@ -0,0 +1,73 @@
+#ifndef IO_PIPELINE_H
+#define IO_PIPELINE_H
+
+#include "batch.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * Queue between two pipeline stages holding at most capacity items.
+ * push blocks while it is full and pop while it is empty; after close,
+ * push fails and pop drains what is left and then fails.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : capacity_(capacity < 1 ? 1 : capacity), closed_(false) {}
+
+	bool push(T item)
+	{
+		unique_lock<mutex> guard(lock_);
+		not_full_.wait(guard, [this] { return closed_ || items_.size() < capacity_; });
+		if (closed_) {
+			return false;
+		}
+		items_.push_back(move(item));
+		not_empty_.notify_one();
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		unique_lock<mutex> guard(lock_);
+		not_empty_.wait(guard, [this] { return closed_ || !items_.empty(); });
+		if (items_.empty()) {
+			return false;
+		}
+		item = move(items_.front());
+		items_.pop_front();
+		not_full_.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		lock_guard<mutex> guard(lock_);
+		closed_ = true;
+		not_full_.notify_all();
+		not_empty_.notify_all();
+	}
+
+private:
+	size_t capacity_;
+	bool closed_;
+	deque<T> items_;
+	mutex lock_;
+	condition_variable not_full_;
+	condition_variable not_empty_;
+};
+
+/**
+ * Processes the files as a three stage pipeline: a reader thread decodes up
+ * to options.prefetch files ahead, options.threads filter threads run the
+ * operations, and a writer thread encodes and writes the results behind
+ * them, with bounded queues between the stages. Files are read in order
+ * and written one at a time, so each disk sees a single stream. Built with
+ * IMAGE_IO_URING (make IO_URING=1) the reader submits the pixel reads of a
+ * whole prefetch window to io_uring at once instead.
+ * @return How many files were processed and how many failed
+ */
+BatchSummary run_io_pipeline(const vector<path>& files, const BatchOptions& options);
+
+#endif
@@ -0,0 +1,264 @@
+#include "kernels.h"
+#include "parallel.h"
+#include "simd.h"
+#include "tone.h"
+#include "vignette.h"
+
+// Multiplies and adds are never fused, whatever the build flags, so these give the bytes of the vector kernels
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+static bool fixed_mode = false;
+
+// Selects fixed point arithmetic for the scaling filters; call before filtering
+void set_fixed_point(bool enabled)
+{
+    fixed_mode = enabled;
+}
+
+// Returns whether the scaling filters use fixed point arithmetic
+bool fixed_point()
+{
+    return fixed_mode;
+}
+
+// Scales the channels of count pixels by weights running from the weight pointer in steps of step
+static inline void weight_pixels(const unsigned char* in, unsigned char* out, int count, const uint16_t* weight, int step)
+{
+    for (int x = 0; x < count; x++) {
+        unsigned int w = weight[x * step];
+        out[3*x]   = (unsigned char)((in[3*x]   * w) >> VIGNETTE_SHIFT);
+        out[3*x+1] = (unsigned char)((in[3*x+1] * w) >> VIGNETTE_SHIFT);
+        out[3*x+2] = (unsigned char)((in[3*x+2] * w) >> VIGNETTE_SHIFT);
+    }
+}
+
+// Vignette: scales each pixel down with its distance from the centre, using the cached mask
+static void vignette_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    const VignetteMask& mask = vignette_mask(width, height);
+    const uint16_t* weights = mask.row(abs(y - mask.center_y));
+    int center_x = mask.center_x;
+    // Left of the centre |dx| falls from center_x to 1, from the centre on it rises from 0
+    weight_pixels(in, out, center_x, weights + center_x, -1);
+    weight_pixels(in + 3 * center_x, out + 3 * center_x, width - center_x, weights, 1);
+}
+
+// Claredon: lightens light pixels and darkens dark ones
+static void claredon_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    double scaling_factor = params.scaling_factor;
+    int newblue=0, newred=0, newgreen=0;
+    for (int x = 0; x < width; x++) {
+        int b = in[3*x];
+        int g = in[3*x+1];
+        int r = in[3*x+2];
+        int average = average_of_three(b + g + r);
+        if (average > 170) {
+            newblue = int(255 - (255 - b) * scaling_factor);
+            newgreen = int(255 - (255 - g) * scaling_factor);
+            newred = int(255 - (255 - r) * scaling_factor);
+        }
+        else if (average < 90) {
+            newblue = b * scaling_factor;
+            newgreen = g * scaling_factor;
+            newred = r * scaling_factor;
+        }
+        else {
+            newblue = b ;
+            newgreen = g ;
+            newred = r ;
+        }
+        out[3*x]   = clamp_byte(newblue);
+        out[3*x+1] = clamp_byte(newgreen);
+        out[3*x+2] = clamp_byte(newred);
+    }
+}
+
+// Grayscale: replaces each channel with the channel average
+static void grayscale_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    for (int x = 0; x < width; x++) {
+        int b = in[3*x];
+        int g = in[3*x+1];
+        int r = in[3*x+2];
+        unsigned char average = (unsigned char)average_of_three(b + g + r);
+        out[3*x]   = average;
+        out[3*x+1] = (unsigned char)average;
+        out[3*x+2] = (unsigned char)average;
+    }
+}
+
+// High contrast: black or white depending on whether the channel average reaches the threshold
+static void highcontrast_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    int threshold = params.threshold;
+    for (int x = 0; x < width; x++) {
+        int b = in[3*x];
+        int g = in[3*x+1];
+        int r = in[3*x+2];
+        int average = average_of_three(b + g + r);
+        unsigned char value = (average >= threshold) ? 255 : 0;
+        out[3*x]   = value;
+        out[3*x+1] = value;
+        out[3*x+2] = value;
+    }
+}
+
+// Lighten: scales each channel's distance from white
+static void lighten_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    double scaling_factor = params.scaling_factor;
+    for (int i = 0; i < width * 3; i++) {
+        out[i] = clamp_byte(int(255 - (255 - in[i]) * scaling_factor));
+    }
+}
+
+// Darken: scales each channel towards black
+static void darken_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    double scaling_factor = params.scaling_factor;
+    for (int i = 0; i < width * 3; i++) {
+        out[i] = clamp_byte(int(in[i] * scaling_factor));
+    }
+}
+
+// Claredon in fixed point (see set_fixed_point)
+static void claredon_fixed_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    uint32_t factor = fixed_factor(params.scaling_factor);
+    for (int x = 0; x < width; x++) {
+        int b = in[3*x];
+        int g = in[3*x+1];
+        int r = in[3*x+2];
+        int average = average_of_three(b + g + r);
+        if (average > 170) {
+            b = fixed_lighten(b, factor);
+            g = fixed_lighten(g, factor);
+            r = fixed_lighten(r, factor);
+        }
+        else if (average < 90) {
+            b = fixed_darken(b, factor);
+            g = fixed_darken(g, factor);
+            r = fixed_darken(r, factor);
+        }
+        out[3*x]   = (unsigned char)b;
+        out[3*x+1] = (unsigned char)g;
+        out[3*x+2] = (unsigned char)r;
+    }
+}
+
+// Lighten in fixed point (see set_fixed_point)
+static void lighten_fixed_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    uint32_t factor = fixed_factor(params.scaling_factor);
+    for (int i = 0; i < width * 3; i++) {
+        out[i] = (unsigned char)fixed_lighten(in[i], factor);
+    }
+}
+
+// Darken in fixed point (see set_fixed_point)
+static void darken_fixed_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    uint32_t factor = fixed_factor(params.scaling_factor);
+    for (int i = 0; i < width * 3; i++) {
+        out[i] = (unsigned char)fixed_darken(in[i], factor);
+    }
+}
+
+// Black, white, red, green, blue: snaps each pixel to the nearest of five colours, by the channel sum cut-offs
+static void bwrgb_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    int dark_sum = params.dark_sum;
+    int light_sum = params.light_sum;
+    int newblue = 0, newred = 0, newgreen = 0;
+    for (int x = 0; x < width; x++) {
+        int b = in[3*x];
+        int g = in[3*x+1];
+        int r = in[3*x+2];
+        int sumV = b + g + r;
+        int maxV = maximum(b,g,r);
+
+        if (sumV >= light_sum) {
+            newred = 255;
+            newgreen = 255;
+            newblue = 255;
+        }
+        else if (sumV <= dark_sum) {
+            newred = 0;
+            newgreen = 0;
+            newblue = 0;
+        }
+        else if (maxV == r) {
+            newred = 255;
+            newgreen = 0;
+            newblue = 0;
+        }
+        else if (maxV == b) {
+            newred = 0;
+            newgreen = 0;
+            newblue = 255;
+        }
+        else {
+            newred = 0;
+            newgreen = 255;
+            newblue = 0;
+        }
+        out[3*x]   = newblue;
+        out[3*x+1] = newgreen;
+        out[3*x+2] = newred;
+    }
+}
+
+// Returns true if the processor keeps every pixel in place, so the output has the input geometry
+bool is_point_filter(int userChoice)
+{
+    return scalar_kernel(userChoice) != nullptr;
+}
+
+// Returns the scanline kernel of a point filter, or nullptr for the geometric processors
+RowKernel point_kernel(int userChoice)
+{
+    RowKernel kernel = simd_kernel(userChoice);
+    if (kernel == nullptr) {
+        kernel = tone_kernel(userChoice);
+    }
+    return kernel != nullptr ? kernel : scalar_kernel(userChoice);
+}
+
+// Returns the plain C++ kernel of a point filter, the reference the vectorized kernels must match
+RowKernel scalar_kernel(int userChoice)
+{
+    if (fixed_mode) {
+        switch (userChoice) {
+        case 2:  return claredon_fixed_row;
+        case 8:  return lighten_fixed_row;
+        case 9:  return darken_fixed_row;
+        }
+    }
+    switch (userChoice) {
+    case 1:  return vignette_row;
+    case 2:  return claredon_row;
+    case 3:  return grayscale_row;
+    case 7:  return highcontrast_row;
+    case 8:  return lighten_row;
+    case 9:  return darken_row;
+    case 10: return bwrgb_row;
+    }
+    // The curve filters are defined by their tables
+    return is_tone_filter(userChoice) ? tone_kernel(userChoice) : nullptr;
+}
+
+// Runs a point filter over every row of image into new_image, which may be image itself
+void apply_point_filter(const Image& image, Image& new_image, int userChoice, const FilterParams& params)
+{
+    RowKernel kernel = point_kernel(userChoice);
+    parallel_rows(image.height, image.stride, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            kernel(image.row(y), new_image.row(y), image.width, y, image.height, params);
+        }
+    });
+}
@@ -0,0 +1,70 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "image.h"
+
+/**
+ * Scanline kernel of a point filter.
+ * Reads width BGR pixels from in and writes the filtered pixels to out; in and
+ * out may point at the same row. y and height locate the row in the image for
+ * filters that depend on the pixel position (vignette).
+ */
+typedef void (*RowKernel)(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params);
+
+// Returns true if the processor keeps every pixel in place, so the output has the input geometry
+bool is_point_filter(int userChoice);
+
+// Returns the fastest scanline kernel of a point filter (vectorized, then table driven), or nullptr for the geometric processors
+RowKernel point_kernel(int userChoice);
+
+// Returns the plain C++ kernel of a point filter, the reference the vectorized kernels must match
+RowKernel scalar_kernel(int userChoice);
+
+// Runs a point filter over every row of image into new_image, which may be image itself
+void apply_point_filter(const Image& image, Image& new_image, int userChoice, const FilterParams& params);
+
+// Clamps an int to the 0-255 range of a channel
+inline unsigned char clamp_byte(int value) {
+	return (unsigned char)(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+/**
+ * Fixed point mode: claredon, lighten and darken scale channels by the
+ * scaling factor in Q16.16 integer arithmetic instead of double (channel
+ * averages are integer in either mode, see average_of_three). A scaled
+ * channel keeps the double formula's truncation and differs
+ * from the double result by at most 1, only where the exact product lies
+ * within 255/131072 of an integer, for factors from 0 to 256; factors
+ * outside that range saturate as the double formulas do. Off by default.
+ */
+void set_fixed_point(bool enabled);
+
+// Returns whether the scaling filters use fixed point arithmetic
+bool fixed_point();
+
+// Returns the scaling factor in Q16.16, rounded and clamped to 0..2^24 - 1
+inline uint32_t fixed_factor(double scaling_factor) {
+	if (!(scaling_factor > 0)) {
+		return 0;
+	}
+	return scaling_factor >= 256 ? 0xFFFFFF : (uint32_t)min(lround(scaling_factor * 65536), 0xFFFFFFL);
+}
+
+// Darken in fixed point: v * factor, truncated and clamped to 255 (255 * (2^24 - 1) fits 32 bits)
+inline unsigned int fixed_darken(unsigned int v, uint32_t factor) {
+	unsigned int scaled = (v * factor) >> 16;
+	return scaled > 255 ? 255 : scaled;
+}
+
+// Lighten in fixed point: 255 - (255 - v) * factor, truncated like the double formula and clamped to 0
+inline unsigned int fixed_lighten(unsigned int v, uint32_t factor) {
+	unsigned int scaled = ((255 - v) * factor + 0xFFFF) >> 16;
+	return scaled > 255 ? 0 : 255 - scaled;
+}
+
+// Average of three channels: sum / 3 for every sum up to 765, as a 16-bit multiply high
+inline unsigned int average_of_three(unsigned int sum) {
+	return (sum * 21846) >> 16;
+}
+
+#endif
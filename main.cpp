@@ -9,6 +9,9 @@
 #include <map>
 #include <filesystem>
 #include "image.h"
+#include "batch.h"
+#include "server.h"
+#include "metrics.h"
 
 using namespace std;
 using namespace std::filesystem;
@@ -17,8 +20,15 @@ using namespace std::filesystem;
 
 
 
-int main()
+int main(int argc, char* argv[])
 {
+	// Any arguments select the job server, its client or the headless batch mode
+	if (argc > 1 && (string(argv[1]) == "--serve" || string(argv[1]) == "--client")) {
+		return server_main(argc, argv);
+	}
+	if (argc > 1) {
+		return batch_main(argc, argv);
+	}
 	bool exitOption = false;
 	int progItr = 0;
 	while (!exitOption) {
@@ -46,28 +56,8 @@ int main()
 		if (filePath == "Q") { break; }
 		std::cout << filePath << " is a valid bmp file. " << endl;
 
-		std::map<int, ImageProcessor> mapOfProcessors;
+		std::map<int, ImageProcessor> mapOfProcessors = build_processors();
 		std::map<int, ImageProcessor>::iterator it;
-		ImageProcessor process_1{ "vignette","Adds vignette effect to image (dark corners)" };
-		mapOfProcessors[1] = process_1;
-		ImageProcessor process_2{ "claredon","Adds claredon type effect to image - darks darker and lights lighter" };
-		mapOfProcessors[2] = process_2;
-		ImageProcessor process_3{ "grayscale","Grayscale image" };
-		mapOfProcessors[3] = process_3;
-		ImageProcessor process_4{ "rotate90","Rotates image by 90 degrees clockwise (not counter-clockwise)" };
-		mapOfProcessors[4] = process_4;
-		ImageProcessor process_5{ "rotate90x","Rotates image by multiples of 90 degrees clockwise" };
-		mapOfProcessors[5] = process_5;
-		ImageProcessor process_6{ "enlarge","Enlarges the image in the x and y direction" };
-		mapOfProcessors[6] = process_6;
-		ImageProcessor process_7{ "highcontrast","Convert image to high contrast - black and white only" };
-		mapOfProcessors[7] = process_7;
-		ImageProcessor process_8{ "lighten","Lightens image" };
-		mapOfProcessors[8] = process_8;
-		ImageProcessor process_9{ "darken","Darkens image" };
-		mapOfProcessors[9] = process_9;
-		ImageProcessor process_10{ "bwrgb","Converts image to only black, white, red, blue, and green" };
-		mapOfProcessors[10] = process_10;
 		std::cout << " Please select from the following image processing options: " << endl;
 		for (it = mapOfProcessors.begin(); it != mapOfProcessors.end(); it++) {
 			std::cout << "  " << it->first << " - " << it->second.name << " - " << it->second.description << endl;
@@ -76,10 +66,11 @@ int main()
 		int userChoice = 99;
 		std::cin >> userChoice;
 		int procStatus = readInImageFile(path2bmp, userChoice, mapOfProcessors);
-		if (procStatus == 1) { return 1; }
-		if (procStatus == 2) { return 0; }
+		if (procStatus == 1) { METRICS_REPORT(); return 1; }
+		if (procStatus == 2) { METRICS_REPORT(); return 0; }
 		progItr++;
 	}
 
+	METRICS_REPORT();
     return 0;
 }
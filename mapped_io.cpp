@@ -0,0 +1,185 @@
+#include "mapped_io.h"
+#include "kernels.h"
+#include "histogram.h"
+#include "parallel.h"
+#include "metrics.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : fd_(-1), data_(nullptr), size_(0) {}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifndef _WIN32
+
+bool MappedFile::open_read(const path& file)
+{
+    close();
+    fd_ = ::open(file.c_str(), O_RDONLY);
+    return map(PROT_READ, false);
+}
+
+bool MappedFile::open_write(const path& file)
+{
+    close();
+    fd_ = ::open(file.c_str(), O_RDWR);
+    return map(PROT_READ | PROT_WRITE, true);
+}
+
+bool MappedFile::create(const path& file, size_t size)
+{
+    close();
+    remove_output(file);
+    fd_ = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0 || ftruncate(fd_, (off_t)size) != 0) {
+        close();
+        return false;
+    }
+    return map(PROT_READ | PROT_WRITE, true);
+}
+
+// Maps the whole of the open file descriptor
+bool MappedFile::map(int flags, bool writable)
+{
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0 || st.st_size == 0) {
+        close();
+        return false;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, flags, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+        close();
+        return false;
+    }
+    data_ = (unsigned char*)data;
+    size_ = (size_t)st.st_size;
+    // Every filter walks the pixel array front to back
+    madvise(data_, size_, MADV_SEQUENTIAL);
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = -1;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#else
+
+// No mmap here; process_mapped takes the buffered path instead
+bool MappedFile::open_read(const path& file) { return false; }
+bool MappedFile::open_write(const path& file) { return false; }
+bool MappedFile::create(const path& file, size_t size) { return false; }
+bool MappedFile::map(int flags, bool writable) { return false; }
+void MappedFile::close() {}
+
+#endif
+
+// Runs the filter through read_image and write_image, an adaptive one from the histogram read_image counts
+static bool process_buffered(path inputFile, path outputFile, int userChoice, const FilterParams& params)
+{
+    Histogram histogram;
+    histogram.parts = histogram_parts(userChoice, params);
+    Image image = read_image(inputFile.string(), histogram.parts != 0 ? &histogram : nullptr);
+    if (image.empty()) {
+        return false;
+    }
+    FilterParams resolved = params;
+    resolve_adaptive(userChoice, resolved, histogram);
+    apply_point_filter(image, image, userChoice, resolved);
+    return write_image(outputFile.string(), image);
+}
+
+/**
+ * Runs a point filter from a read-only mapping of inputFile directly into a
+ * mapping of the preallocated outputFile, with no intermediate image buffers.
+ * When outputFile is inputFile, and has no other links, the filter runs in
+ * place on the mapped file.
+ * @param inputFile  The 24-bit BMP file to filter
+ * @param outputFile The BMP file to write
+ * @param userChoice The point filter to run, or an adaptive processor (see histogram.h)
+ * @param params     Parameters of the filter
+ * @return True if the output was written and false otherwise
+ */
+bool process_mapped(path inputFile, path outputFile, int userChoice, const FilterParams& params)
+{
+    if (point_kernel(userChoice) == nullptr && !is_adaptive(userChoice, params)) {
+        return false;
+    }
+    METRICS_SPAN(STAGE_PROCESS);
+
+    // A file with other links (a result cache entry) gets a new output instead, read from the mapping of the old one
+    error_code ec;
+    bool in_place = equivalent(inputFile, outputFile, ec) && hard_link_count(inputFile, ec) == 1;
+
+    MappedFile input;
+    bool mapped = in_place ? input.open_write(inputFile) : input.open_read(inputFile);
+    if (!mapped) {
+        return process_buffered(inputFile, outputFile, userChoice, params);
+    }
+
+    BmpInfo info;
+    if (input.size() < BMP_FILE_HEADER_SIZE || !parse_bmp_header(input.data(), info)) {
+        // Not 24-bit; read_image decodes the formats it knows
+        input.close();
+        return process_buffered(inputFile, outputFile, userChoice, params);
+    }
+    size_t stride = bmp_encoded_size(info.width, 1) - BMP_FILE_HEADER_SIZE;
+    if (input.size() < info.start + stride * info.height) {
+        return false;
+    }
+    const unsigned char* pixels = input.data() + info.start;
+    METRICS_COUNT(COUNTER_PIXELS, (uint64_t)info.width * info.height);
+    METRICS_COUNT(COUNTER_BYTES_READ, input.size());
+
+    FilterParams resolved = params;
+    if (is_adaptive(userChoice, params)) {
+        // Counting pulls the input into the page cache ahead of the filter pass
+        Histogram histogram = rows_histogram(pixels, stride, info.width, info.height, histogram_parts(userChoice, params));
+        resolve_adaptive(userChoice, resolved, histogram);
+    }
+    RowKernel kernel = point_kernel(userChoice);
+
+    if (in_place) {
+        parallel_rows(info.height, stride, [&](int first, int last) {
+            for (int y = first; y < last; y++) {
+                unsigned char* row = input.data() + info.start + stride * y;
+                int image_y = info.top_down ? info.height - 1 - y : y;
+                kernel(row, row, info.width, image_y, info.height, resolved);
+            }
+        });
+        METRICS_COUNT(COUNTER_BYTES_WRITTEN, stride * info.height);
+        return true;
+    }
+
+    MappedFile output;
+    if (!output.create(outputFile, bmp_encoded_size(info.width, info.height))) {
+        input.close();
+        return process_buffered(inputFile, outputFile, userChoice, resolved);
+    }
+    encode_bmp_header(output.data(), info.width, info.height);
+    METRICS_COUNT(COUNTER_BYTES_WRITTEN, output.size());
+    unsigned char* out = output.data() + BMP_FILE_HEADER_SIZE;
+    parallel_rows(info.height, stride, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            int source_y = info.top_down ? info.height - 1 - y : y;
+            kernel(pixels + stride * source_y, out + stride * y, info.width, y, info.height, resolved);
+        }
+    });
+    return true;
+}
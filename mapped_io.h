@@ -0,0 +1,49 @@
+#ifndef MAPPED_IO_H
+#define MAPPED_IO_H
+
+#include "image.h"
+
+/**
+ * Memory mapping of a whole file.
+ * Unmaps (and closes) the file when destroyed.
+ */
+class MappedFile {
+public:
+	MappedFile();
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Maps an existing file read-only
+	bool open_read(const path& file);
+
+	// Maps an existing file for reading and writing; writes go to the file
+	bool open_write(const path& file);
+
+	// Creates the file anew (see remove_output) with the given size and maps it for writing
+	bool create(const path& file, size_t size);
+
+	void close();
+
+	unsigned char* data() { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	bool map(int flags, bool writable);
+
+	int fd_;
+	unsigned char* data_;
+	size_t size_;
+};
+
+/**
+ * Runs a point filter from a read-only mapping of inputFile directly into a
+ * mapping of the preallocated outputFile, with no intermediate image buffers.
+ * When outputFile is inputFile the filter runs in place on the mapped file.
+ * An adaptive processor first counts its histogram from the input mapping.
+ * Falls back to read_image / write_image where files cannot be mapped.
+ * @return True if the output was written and false otherwise
+ */
+bool process_mapped(path inputFile, path outputFile, int userChoice, const FilterParams& params);
+
+#endif
@@ -0,0 +1,215 @@
+#include "metrics.h"
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sstream>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#ifdef COUNT_ALLOCATIONS
+
+static atomic<uint64_t> total_allocations(0);
+static atomic<uint64_t> total_allocated(0);
+static thread_local uint64_t thread_allocations = 0;
+
+void* operator new(size_t size)
+{
+    total_allocations.fetch_add(1, memory_order_relaxed);
+    total_allocated.fetch_add(size, memory_order_relaxed);
+    thread_allocations++;
+    void* pointer = malloc(size == 0 ? 1 : size);
+    if (pointer == nullptr) {
+        throw bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    free(pointer);
+}
+
+uint64_t allocation_count() { return total_allocations.load(); }
+uint64_t allocated_bytes() { return total_allocated.load(); }
+uint64_t thread_allocation_count() { return thread_allocations; }
+void add_thread_allocations(uint64_t count) { thread_allocations += count; }
+
+#else
+
+uint64_t allocation_count() { return 0; }
+uint64_t allocated_bytes() { return 0; }
+uint64_t thread_allocation_count() { return 0; }
+void add_thread_allocations(uint64_t count) {}
+
+#endif
+
+// The image being recorded on this thread, the innermost open span and the allocation count at the start
+static thread_local ImageMetrics* current = nullptr;
+static thread_local MetricsSpan* active_span = nullptr;
+static thread_local uint64_t start_allocations = 0;
+
+// Run totals
+static mutex run_mutex;
+static ImageMetrics run_totals;
+static int run_images = 0;
+static int run_failed = 0;
+
+static const char* STAGE_NAMES[STAGE_COUNT] = { "header", "decode", "process", "write" };
+static const char* COUNTER_NAMES[COUNTER_COUNT] = { "bytes_read", "bytes_written", "pixels" };
+
+MetricsSpan::MetricsSpan(MetricsStage stage)
+    : stage(stage), elapsed(0), start(chrono::steady_clock::now()), parent(active_span)
+{
+    if (parent != nullptr) {
+        parent->elapsed += chrono::duration<double>(start - parent->start).count();
+    }
+    active_span = this;
+}
+
+MetricsSpan::~MetricsSpan()
+{
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (current != nullptr) {
+        current->seconds[stage] += elapsed + chrono::duration<double>(now - start).count();
+    }
+    active_span = parent;
+    if (parent != nullptr) {
+        parent->start = now;
+    }
+}
+
+// Adds amount to a counter of the image being processed on this thread
+void metrics_count(MetricsCounter counter, uint64_t amount)
+{
+    if (current != nullptr) {
+        current->counters[counter] += amount;
+    }
+}
+
+// Starts recording the metrics of an image on this thread
+void metrics_begin_image()
+{
+    current = new ImageMetrics();
+    start_allocations = thread_allocation_count();
+}
+
+// Stops recording on this thread and returns the record, with the allocations made so far, or nullptr
+ImageMetrics* metrics_suspend_image()
+{
+    ImageMetrics* metrics = current;
+    if (metrics != nullptr) {
+        metrics->allocations += thread_allocation_count() - start_allocations;
+        current = nullptr;
+    }
+    return metrics;
+}
+
+// Carries on recording a suspended record on this thread
+void metrics_resume_image(ImageMetrics* metrics)
+{
+    current = metrics;
+    start_allocations = thread_allocation_count();
+}
+
+// Returns the peak resident set size of the process in kilobytes
+static long peak_rss_kb()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        return usage.ru_maxrss;
+    }
+#endif
+    return 0;
+}
+
+// Writes the fields of metrics as JSON members
+static void write_fields(ostream& out, const ImageMetrics& metrics)
+{
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        out << ", \"" << STAGE_NAMES[i] << "_ms\": " << metrics.seconds[i] * 1000;
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        out << ", \"" << COUNTER_NAMES[i] << "\": " << metrics.counters[i];
+    }
+    out << ", \"allocations\": " << metrics.allocations << ", \"peak_rss_kb\": " << peak_rss_kb();
+}
+
+/**
+ * Stops recording the metrics of the image on this thread, logs them as one
+ * JSON line on std::cerr and adds them to the run totals.
+ * @param inputFile The image the metrics are for
+ * @param succeeded Whether the image was processed
+ */
+void metrics_end_image(const path& inputFile, bool succeeded)
+{
+    ImageMetrics* metrics = current;
+    if (metrics == nullptr) {
+        return;
+    }
+    current = nullptr;
+    // The allocation for the record itself was made before the count started
+    metrics->allocations += thread_allocation_count() - start_allocations;
+
+    string file = inputFile.string();
+    string escaped;
+    for (char c : file) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    stringstream line;
+    line << "{\"event\": \"image\", \"file\": \"" << escaped << "\", \"ok\": " << (succeeded ? "true" : "false");
+    write_fields(line, *metrics);
+    line << "}" << endl;
+
+    lock_guard<mutex> lock(run_mutex);
+    cerr << line.str();
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        run_totals.seconds[i] += metrics->seconds[i];
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        run_totals.counters[i] += metrics->counters[i];
+    }
+    run_totals.allocations += metrics->allocations;
+    run_images++;
+    if (!succeeded) {
+        run_failed++;
+    }
+    delete metrics;
+}
+
+// Logs the run totals as one JSON line on std::cerr, if any image was recorded
+void metrics_report()
+{
+    lock_guard<mutex> lock(run_mutex);
+    if (run_images == 0) {
+        return;
+    }
+    cerr << "{\"event\": \"run\", \"images\": " << run_images << ", \"failed\": " << run_failed;
+    write_fields(cerr, run_totals);
+    cerr << "}" << endl;
+}
@@ -0,0 +1,112 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "image.h"
+#include <chrono>
+
+/**
+ * Per-image instrumentation, compiled in with -DIMAGE_METRICS (make METRICS=1).
+ * Spans time the stages of each image and counters add up the bytes and
+ * pixels it moved; every image processed by process_file is logged to
+ * std::cerr as one JSON line and the run totals follow at exit. Memory
+ * mapped filters do their I/O through page faults, which counts as process
+ * time. An image that moves between threads, as in the --prefetch pipeline,
+ * is suspended on one and resumed on the next. Without IMAGE_METRICS the macros below expand to nothing.
+ */
+
+// Stages timed per image
+enum MetricsStage {
+	STAGE_HEADER,
+	STAGE_DECODE,
+	STAGE_PROCESS,
+	STAGE_WRITE,
+	STAGE_COUNT
+};
+
+// Quantities counted per image
+enum MetricsCounter {
+	COUNTER_BYTES_READ,
+	COUNTER_BYTES_WRITTEN,
+	COUNTER_PIXELS,
+	COUNTER_COUNT
+};
+
+// What was measured for one image, or summed over a run
+struct ImageMetrics {
+	double seconds[STAGE_COUNT] = {};
+	uint64_t counters[COUNTER_COUNT] = {};
+	uint64_t allocations = 0;
+};
+
+/**
+ * Times a stage from construction to destruction on the calling thread.
+ * Spans nest exclusively: while an inner span runs the outer one is paused,
+ * so each moment is charged to a single stage.
+ */
+class MetricsSpan {
+public:
+	explicit MetricsSpan(MetricsStage stage);
+	~MetricsSpan();
+private:
+	MetricsStage stage;
+	double elapsed;
+	chrono::steady_clock::time_point start;
+	MetricsSpan* parent;
+};
+
+// Adds amount to a counter of the image being processed on this thread
+void metrics_count(MetricsCounter counter, uint64_t amount);
+
+// Starts recording the metrics of an image on this thread
+void metrics_begin_image();
+
+// Stops recording, logs the image and adds it to the run totals
+void metrics_end_image(const path& inputFile, bool succeeded);
+
+// Stops recording on this thread and hands over the image's record, or nullptr if none, to resume elsewhere
+ImageMetrics* metrics_suspend_image();
+
+// Carries on recording the image of a suspended record on this thread; nullptr records nothing
+void metrics_resume_image(ImageMetrics* metrics);
+
+// Logs the run totals, if any image was recorded
+void metrics_report();
+
+#ifdef IMAGE_METRICS
+#define METRICS_JOIN2(a, b) a##b
+#define METRICS_JOIN(a, b) METRICS_JOIN2(a, b)
+#define METRICS_SPAN(stage) MetricsSpan METRICS_JOIN(metrics_span_, __LINE__)(stage)
+#define METRICS_COUNT(counter, amount) metrics_count(counter, amount)
+#define METRICS_BEGIN_IMAGE() metrics_begin_image()
+#define METRICS_END_IMAGE(inputFile, succeeded) metrics_end_image(inputFile, succeeded)
+#define METRICS_SUSPEND_IMAGE() metrics_suspend_image()
+#define METRICS_RESUME_IMAGE(metrics) metrics_resume_image(metrics)
+#define METRICS_REPORT() metrics_report()
+#else
+#define METRICS_SPAN(stage)
+#define METRICS_COUNT(counter, amount)
+#define METRICS_BEGIN_IMAGE()
+#define METRICS_END_IMAGE(inputFile, succeeded)
+#define METRICS_SUSPEND_IMAGE() nullptr
+#define METRICS_RESUME_IMAGE(metrics)
+#define METRICS_REPORT()
+#endif
+
+// Metrics count allocations; so does bench, which builds with -DCOUNT_ALLOCATIONS
+#if defined(IMAGE_METRICS) && !defined(COUNT_ALLOCATIONS)
+#define COUNT_ALLOCATIONS
+#endif
+
+// Returns the heap allocations made so far by the process (0 unless counting allocations)
+uint64_t allocation_count();
+
+// Returns the bytes allocated so far by the process (0 unless counting allocations)
+uint64_t allocated_bytes();
+
+// Returns the heap allocations made so far by the calling thread (0 unless counting allocations)
+uint64_t thread_allocation_count();
+
+// Charges allocations that helper threads made for the calling thread's work to its count
+void add_thread_allocations(uint64_t count);
+
+#endif
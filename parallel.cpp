@@ -0,0 +1,79 @@
+#include "parallel.h"
+#include "threadpool.h"
+#include "metrics.h"
+
+// Below this much row data the threads cost more than they save
+const size_t MIN_PARALLEL_BYTES = (size_t)256 << 10;
+
+static int configured_threads = 0;
+static mutex pool_lock;
+static unique_ptr<ThreadPool> filter_pool;
+
+// Sets how many threads a single filter may use, 0 for one per hardware thread; call before filtering
+void set_filter_threads(int threads)
+{
+    lock_guard<mutex> guard(pool_lock);
+    configured_threads = threads;
+    filter_pool.reset();
+}
+
+// Returns how many threads a single filter uses
+int filter_threads()
+{
+    int threads = configured_threads;
+    if (threads < 1) {
+        threads = (int)thread::hardware_concurrency();
+    }
+    return threads < 1 ? 1 : threads;
+}
+
+// Returns the shared pool of helper threads, started on first use
+static ThreadPool& helpers()
+{
+    lock_guard<mutex> guard(pool_lock);
+    if (!filter_pool) {
+        // The calling thread works too, so one thread fewer is enough
+        filter_pool.reset(new ThreadPool(filter_threads() - 1));
+    }
+    return *filter_pool;
+}
+
+/**
+ * Splits rows [0, rows) into one contiguous band per filter thread and calls
+ * body(first, last) for each band.
+ * @param rows      Number of rows
+ * @param row_bytes Bytes of data per row, used to skip threading small jobs
+ * @param body      Processes rows first to last - 1
+ */
+void parallel_rows(int rows, size_t row_bytes, const function<void(int, int)>& body)
+{
+    int bands = min(filter_threads(), rows);
+    if (bands <= 1 || (size_t)rows * row_bytes < MIN_PARALLEL_BYTES) {
+        body(0, rows);
+        return;
+    }
+    ThreadPool& pool = helpers();
+    mutex done_lock;
+    condition_variable done;
+    int remaining = bands - 1;
+    // Allocations on the helpers belong to the image the calling thread is recording
+    uint64_t helper_allocations = 0;
+    for (int i = 1; i < bands; i++) {
+        int first = (int)((long long)rows * i / bands);
+        int last = (int)((long long)rows * (i + 1) / bands);
+        pool.submit([&, first, last] {
+            uint64_t allocations = thread_allocation_count();
+            body(first, last);
+            allocations = thread_allocation_count() - allocations;
+            lock_guard<mutex> guard(done_lock);
+            helper_allocations += allocations;
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        });
+    }
+    body(0, (int)((long long)rows / bands));
+    unique_lock<mutex> guard(done_lock);
+    done.wait(guard, [&] { return remaining == 0; });
+    add_thread_allocations(helper_allocations);
+}
@@ -0,0 +1,27 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+using namespace std;
+
+// Sets how many threads a single filter may use, 0 for one per hardware thread; call before filtering
+void set_filter_threads(int threads);
+
+// Returns how many threads a single filter uses
+int filter_threads();
+
+/**
+ * Splits rows [0, rows) into one contiguous band per filter thread and calls
+ * body(first, last) for each band, the calling thread taking the first band.
+ * Returns when every band is done. Small jobs (under 256 KB of row data) run
+ * on the calling thread. Each row must be computed independently of the
+ * others so the result does not depend on the number of threads.
+ * @param rows      Number of rows
+ * @param row_bytes Bytes of data per row, used to skip threading small jobs
+ * @param body      Processes rows first to last - 1
+ */
+void parallel_rows(int rows, size_t row_bytes, const function<void(int, int)>& body);
+
+#endif
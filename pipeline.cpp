@@ -0,0 +1,495 @@
+#include "pipeline.h"
+#include "kernels.h"
+#include "tone.h"
+#include "parallel.h"
+#include "mapped_io.h"
+#include "streaming.h"
+#include "view.h"
+#include "metrics.h"
+#include "indexed_bmp.h"
+#include "convolve.h"
+#include "histogram.h"
+#include "result_cache.h"
+#include "threadpool.h"
+#include "resample.h"
+#include <atomic>
+#include <sstream>
+#include <thread>
+
+// One step of a fused run: a kernel, or a curve standing for consecutive tone filters
+struct FusedStage {
+    RowKernel kernel;
+    const FilterParams* params;
+    ToneCurve curve;
+};
+
+// Turns operations[first, last) into stages, composing each run of tone filters into one curve
+static vector<FusedStage> fuse_stages(const vector<Operation>& operations, size_t first, size_t last)
+{
+    vector<FusedStage> stages;
+    size_t i = first;
+    while (i < last) {
+        size_t end = i;
+        while (end < last && is_tone_filter(operations[end].userChoice)) {
+            end++;
+        }
+        if (end - i >= 2) {
+            FusedStage stage = { nullptr, nullptr, identity_curve() };
+            for (size_t k = i; k < end; k++) {
+                stage.curve = compose_curves(stage.curve, tone_curve(operations[k].userChoice, operations[k].params));
+            }
+            stages.push_back(stage);
+            i = end;
+            continue;
+        }
+        FusedStage stage = { point_kernel(operations[i].userChoice), &operations[i].params, ToneCurve() };
+        stages.push_back(stage);
+        i++;
+    }
+    return stages;
+}
+
+// Runs the stages over row y, from in to out (which may be the same row)
+static void run_stages(const vector<FusedStage>& stages, const unsigned char* in, unsigned char* out, int width, int y, int height)
+{
+    // The first stage moves the row across, the rest work on it in place
+    for (size_t k = 0; k < stages.size(); k++) {
+        if (stages[k].kernel != nullptr) {
+            stages[k].kernel(in, out, width, y, height, *stages[k].params);
+        }
+        else {
+            apply_curve_row(stages[k].curve, in, out, width);
+        }
+        in = out;
+    }
+}
+
+/**
+ * Runs operations[first, last), all point filters, over the view in one
+ * pass. A rotated or enlarged view is realised a few rows at a time just
+ * ahead of the filters, so the geometry costs no pass of its own.
+ */
+static Image run_fused(const ImageView& view, const vector<Operation>& operations, size_t first, size_t last)
+{
+    vector<FusedStage> stages = fuse_stages(operations, first, last);
+    const Image& image = *view.source;
+    bool identity = is_identity(view);
+    Image new_image(view.output_width(), view.output_height());
+    int width = new_image.width;
+    int height = new_image.height;
+    parallel_rows(height, new_image.stride, [&](int first_row, int last_row) {
+        for (int y0 = first_row; y0 < last_row; y0 += 32) {
+            int y1 = min(y0 + 32, last_row);
+            if (!identity) {
+                view_rows(view, y0, y1 - y0, new_image.row(y0), new_image.stride);
+            }
+            for (int y = y0; y < y1; y++) {
+                const unsigned char* in = identity ? image.row(y) : new_image.row(y);
+                run_stages(stages, in, new_image.row(y), width, y, height);
+            }
+        }
+    });
+    return new_image;
+}
+
+/**
+ * Runs the operations over the image, leaving the geometric processors at
+ * the end as a view. Geometric processors are only added to the view; it is
+ * realised by the next point filter run, or first if another processor needs
+ * the pixels. Adaptive processors (see histogram.h) are resolved against a
+ * histogram of their input when they are reached, which ends the point
+ * filter run before them.
+ * @param image      The input image
+ * @param operations The processors to run, first to last
+ * @param storage    Receives the last image produced, if any
+ * @param histogram  Histogram of the image, if the decoder counted one, or nullptr
+ * @return A view over image or storage showing the result
+ */
+ImageView run_pipeline_view(const Image& image, const vector<Operation>& operations, Image& storage, const Histogram* histogram)
+{
+    METRICS_SPAN(STAGE_PROCESS);
+    METRICS_COUNT(COUNTER_PIXELS, (uint64_t)image.width * image.height);
+    ImageView view = make_view(image);
+    vector<Operation> resolved = operations;
+    // Rotations and flips move pixels without changing their counts
+    const Histogram* input_histogram = histogram;
+    Histogram counted;
+    size_t i = 0;
+    while (i < resolved.size()) {
+        Operation& operation = resolved[i];
+        if (is_view_op(operation.userChoice, operation.params)) {
+            apply_view_op(view, operation.userChoice, operation.params);
+            if (operation.userChoice == 6) {
+                input_histogram = nullptr;
+                // Scales that overflow the image fail it
+                if (!view_fits(view)) {
+                    storage = Image();
+                    return make_view(storage);
+                }
+            }
+            i++;
+            continue;
+        }
+        int parts = histogram_parts(operation.userChoice, operation.params);
+        if (parts != 0) {
+            if (input_histogram == nullptr || (input_histogram->parts & parts) != parts) {
+                if (!is_identity(view)) {
+                    storage = realise_view(view);
+                    view = make_view(storage);
+                }
+                counted = image_histogram(*view.source, parts);
+                input_histogram = &counted;
+            }
+            resolve_adaptive(operation.userChoice, operation.params, *input_histogram);
+        }
+        input_histogram = nullptr;
+        size_t last = i;
+        while (last < resolved.size() && is_point_filter(resolved[last].userChoice)
+               && !is_adaptive(resolved[last].userChoice, resolved[last].params)) {
+            last++;
+        }
+        Image result;
+        if (last == i) {
+            if (is_identity(view)) {
+                result = apply_processor(*view.source, operation.userChoice, operation.params);
+            }
+            else {
+                result = apply_processor(realise_view(view), operation.userChoice, operation.params);
+            }
+            last = i + 1;
+        }
+        else {
+            result = run_fused(view, resolved, i, last);
+        }
+        storage = move(result);
+        view = make_view(storage);
+        i = last;
+    }
+    return view;
+}
+
+// Returns the HistogramParts the decoder should count for the operations (see pipeline.h)
+int input_histogram_parts(const vector<Operation>& operations)
+{
+    for (size_t i = 0; i < operations.size(); i++) {
+        int parts = histogram_parts(operations[i].userChoice, operations[i].params);
+        if (parts != 0) {
+            return parts;
+        }
+        if (!is_view_op(operations[i].userChoice, operations[i].params) || operations[i].userChoice == 6) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Runs the operations over the image in order and returns the result.
+ * @param image      The input image
+ * @param operations The processors to run, first to last
+ * @return The resulting image
+ */
+Image run_pipeline(const Image& image, const vector<Operation>& operations)
+{
+    // The source image is only read, never copied
+    Image storage;
+    ImageView view = run_pipeline_view(image, operations, storage);
+    if (view.source == &storage && is_identity(view)) {
+        return storage;
+    }
+    return realise_view(view);
+}
+
+/**
+ * Parses a comma separated list of processors such as "3,9:0.4,1" into
+ * operations.
+ * @param spec       The list of processors
+ * @param operations Receives the parsed operations
+ * @return True if every entry names a processor with finite parameters and false otherwise
+ */
+bool parse_operations(const string& spec, vector<Operation>& operations)
+{
+    stringstream list(spec);
+    string entry;
+    while (getline(list, entry, ',')) {
+        stringstream fields(entry);
+        string field;
+        vector<string> values;
+        while (getline(fields, field, ':')) {
+            values.push_back(field);
+        }
+        Operation operation;
+        try {
+            operation.userChoice = stoi(values.at(0));
+            switch (operation.userChoice) {
+            case 2:
+            case 8:
+            case 9:
+                if (values.size() > 1) { operation.params.scaling_factor = stod(values[1]); }
+                break;
+            case 5:
+                if (values.size() > 1) { operation.params.rotations = stoi(values[1]); }
+                break;
+            case 6:
+                if (values.size() > 1) { operation.params.x_scale = stod(values[1]); }
+                if (values.size() > 2) { operation.params.y_scale = stod(values[2]); }
+                // Scales that make even a single pixel too large
+                if (!scale_fits(1, 1, operation.params.x_scale, operation.params.y_scale)) { return false; }
+                break;
+            case 7:
+                if (values.size() > 1 && values[1] == "auto") { operation.params.automatic = true; }
+                else if (values.size() > 1) { operation.params.threshold = stoi(values[1]); }
+                break;
+            case 10:
+                if (values.size() > 1 && values[1] == "auto") {
+                    operation.params.automatic = true;
+                    if (values.size() > 2) { operation.params.clip = stod(values[2]); }
+                }
+                else {
+                    if (values.size() > 1) { operation.params.dark_sum = stoi(values[1]); }
+                    if (values.size() > 2) { operation.params.light_sum = stoi(values[2]); }
+                }
+                break;
+            case 11:
+                if (values.size() > 1) { operation.params.gamma = stod(values[1]); }
+                break;
+            case 12:
+                if (values.size() > 1) { operation.params.black_point = stoi(values[1]); }
+                if (values.size() > 2) { operation.params.white_point = stoi(values[2]); }
+                break;
+            case 13:
+                if (values.size() > 1) { operation.params.contrast = stod(values[1]); }
+                break;
+            case 16:
+                if (values.size() > 1) { operation.params.radius = stoi(values[1]); }
+                if (values.size() > 2 && !parse_border(values[2], operation.params.border)) { return false; }
+                break;
+            case 17:
+                if (values.size() > 1) { operation.params.sigma = stod(values[1]); }
+                if (values.size() > 2 && !parse_border(values[2], operation.params.border)) { return false; }
+                break;
+            case 18:
+                if (values.size() > 1) { operation.params.sigma = stod(values[1]); }
+                if (values.size() > 2) { operation.params.amount = stod(values[2]); }
+                if (values.size() > 3 && !parse_border(values[3], operation.params.border)) { return false; }
+                break;
+            case 19:
+                if (values.size() > 1 && !parse_border(values[1], operation.params.border)) { return false; }
+                break;
+            case 20:
+                if (values.size() > 1) { operation.params.clip = stod(values[1]); }
+                break;
+            }
+        }
+        catch (const exception&) {
+            return false;
+        }
+        if (!is_processor(operation.userChoice) || !finite_params(operation.params)) {
+            return false;
+        }
+        operations.push_back(operation);
+    }
+    return !operations.empty();
+}
+
+/**
+ * Works out whether the result of the operations is written paletted.
+ * @param operations The processors run
+ * @param palette    Receives the colours the result is limited to, or empty to detect them
+ * @param rle        Receives whether to run length encode
+ * @return True to write a paletted file and false for 24-bit
+ */
+static bool indexed_output(const vector<Operation>& operations, vector<uint32_t>& palette, bool& rle)
+{
+    OutputFormat format = output_format();
+    palette.clear();
+    rle = format == OUTPUT_INDEXED_RLE;
+    if (format == OUTPUT_TRUECOLOR) {
+        return false;
+    }
+    // Geometry after the last filter moves pixels but makes no new colours
+    for (size_t i = operations.size(); i > 0; i--) {
+        int userChoice = operations[i - 1].userChoice;
+        if (is_view_op(userChoice, operations[i - 1].params)) {
+            continue;
+        }
+        palette = processor_palette(userChoice);
+        break;
+    }
+    return format != OUTPUT_AUTO || !palette.empty();
+}
+
+/**
+ * Writes the result of the operations in the format set by set_output_format.
+ * @param filename   The BMP file to write
+ * @param view       The result, as left by run_pipeline_view
+ * @param operations The processors that made it
+ * @return True if successful and false otherwise
+ */
+bool write_result(string filename, const ImageView& view, const vector<Operation>& operations)
+{
+    vector<uint32_t> palette;
+    bool rle = false;
+    if (!indexed_output(operations, palette, rle)) {
+        return write_view(filename, view);
+    }
+    // The paletted writer looks at every pixel before it writes, so the view is realised first
+    if (is_identity(view)) {
+        return write_indexed_image(filename, *view.source, palette, rle);
+    }
+    return write_indexed_image(filename, realise_view(view), palette, rle);
+}
+
+/**
+ * Runs the operations over a decoded image and writes the result, or puts
+ * the cached result there.
+ * @param image      The decoded input, left unchanged
+ * @param histogram  Histogram the decoder counted of the input, or nullptr
+ * @param key        The result_key, or empty when the result cache is not in use
+ * @param outputFile The BMP file to write
+ * @param operations The processors to run, first to last
+ * @return True if the output was written and false otherwise
+ */
+static bool run_decoded(const Image& image, const Histogram* histogram, const string& key, path outputFile, const vector<Operation>& operations)
+{
+    if (!key.empty()) {
+        if (fetch_result(key, outputFile)) {
+            return true;
+        }
+    }
+    // Geometry left at the end is applied by the writer as it goes
+    Image storage;
+    bool written = write_result(outputFile.string(), run_pipeline_view(image, operations, storage, histogram), operations);
+    if (written && !key.empty()) {
+        store_result(key, outputFile);
+    }
+    return written;
+}
+
+// Runs the operations over a BMP file and writes the result (see process_file)
+static bool run_file(path inputFile, path outputFile, const vector<Operation>& operations)
+{
+    vector<uint32_t> palette;
+    bool rle = false;
+    bool cached = result_cache_enabled();
+    if (operations.size() == 1 && !indexed_output(operations, palette, rle)) {
+        const Operation& operation = operations[0];
+        bool adaptive = is_adaptive(operation.userChoice, operation.params);
+        if ((is_point_filter(operation.userChoice) || adaptive) && !cached) {
+            return process_mapped(inputFile, outputFile, operation.userChoice, operation.params);
+        }
+        BmpInfo info;
+        if (read_bmp_info(inputFile.string(), info)) {
+            bool large = (uint64_t)info.width * 3 * info.height > STREAMING_THRESHOLD_BYTES;
+            if ((operation.userChoice == 6 && !cached) || (large && !adaptive && supports_streaming(operation.userChoice))) {
+                return process_streaming(inputFile, outputFile, operation.userChoice, operation.params);
+            }
+        }
+    }
+    Histogram histogram;
+    histogram.parts = input_histogram_parts(operations);
+    Image image = read_image(inputFile.string(), histogram.parts != 0 ? &histogram : nullptr);
+    if (image.empty()) {
+        return false;
+    }
+    return run_decoded(image, &histogram, cached ? result_key(image, operations) : string(), outputFile, operations);
+}
+
+/**
+ * Runs the operations over a BMP file and writes the result, choosing the
+ * cheapest path: a single point filter or adaptive processor runs between
+ * memory mappings, a single scale is always streamed (its output may dwarf
+ * the input), a single processor on an image too large for memory is
+ * streamed, and anything else is decoded, run as in run_pipeline and
+ * written, with any rotations, flips and enlarges left at the end applied by
+ * the writer as it goes. An adaptive processor that only rotations and flips
+ * precede takes the histogram read_image counts as it decodes. Paletted
+ * results (see set_output_format) are always decoded and written whole.
+ * With the result cache open (see result_cache.h) every input that fits in
+ * memory is decoded and hashed, and a hit skips the processors and encoder.
+ * @param inputFile  The BMP file to process
+ * @param outputFile The BMP file to write
+ * @param operations The processors to run, first to last
+ * @return True if the output was written and false otherwise
+ */
+bool process_file(path inputFile, path outputFile, const vector<Operation>& operations)
+{
+    METRICS_BEGIN_IMAGE();
+    bool written = run_file(inputFile, outputFile, operations);
+    METRICS_END_IMAGE(inputFile, written);
+    return written;
+}
+
+// Returns the pool that runs fanout recipes beside the threads that decoded them, started on first use
+static ThreadPool& recipe_helpers()
+{
+    static mutex pool_lock;
+    static unique_ptr<ThreadPool> pool;
+    lock_guard<mutex> guard(pool_lock);
+    if (!pool) {
+        // The decoding thread runs recipes too, so one thread fewer is enough
+        pool.reset(new ThreadPool(max((int)thread::hardware_concurrency() - 1, 1)));
+    }
+    return *pool;
+}
+
+/**
+ * Decodes a BMP file once and runs the recipes against the decoded image at
+ * the same time, each writing its own output. The calling thread and up to
+ * one helper per other recipe from the shared recipe pool take recipes in
+ * turn until none are left, so a batch of fanouts shares one bounded set of
+ * threads. The image is shared read-only, so rotations and flips cost no
+ * copy at all, and with the result cache open its pixels are hashed once
+ * for all the recipes.
+ * @param inputFile   The BMP file to process
+ * @param outputFiles Where the result of each recipe goes
+ * @param recipes     The processors of each output, first to last
+ * @return How many outputs were written
+ */
+int process_fanout(path inputFile, const vector<path>& outputFiles, const vector<vector<Operation>>& recipes)
+{
+    // Count whatever any recipe's first adaptive processor needs while decoding
+    Histogram histogram;
+    for (size_t i = 0; i < recipes.size(); i++) {
+        histogram.parts |= input_histogram_parts(recipes[i]);
+    }
+    METRICS_BEGIN_IMAGE();
+    Image image = read_image(inputFile.string(), histogram.parts != 0 ? &histogram : nullptr);
+    METRICS_END_IMAGE(inputFile, !image.empty());
+    if (image.empty() || recipes.empty()) {
+        return 0;
+    }
+    bool cached = result_cache_enabled();
+    uint64_t pixels = cached ? hash_pixels(image) : 0;
+    atomic<int> written(0);
+    atomic<size_t> next(0);
+    auto run_recipes = [&]() {
+        for (size_t i = next++; i < recipes.size(); i = next++) {
+            METRICS_BEGIN_IMAGE();
+            bool ok = run_decoded(image, &histogram, cached ? result_key(pixels, recipes[i]) : string(), outputFiles[i], recipes[i]);
+            METRICS_END_IMAGE(outputFiles[i], ok);
+            if (ok) {
+                written++;
+            }
+        }
+    };
+    ThreadPool& pool = recipe_helpers();
+    int helpers = (int)min(recipes.size() - 1, (size_t)pool.size());
+    mutex done_lock;
+    condition_variable done;
+    int remaining = helpers;
+    for (int i = 0; i < helpers; i++) {
+        pool.submit([&] {
+            run_recipes();
+            lock_guard<mutex> guard(done_lock);
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        });
+    }
+    // A helper that starts after the recipes are taken finds none and finishes at once
+    run_recipes();
+    unique_lock<mutex> guard(done_lock);
+    done.wait(guard, [&] { return remaining == 0; });
+    return written;
+}
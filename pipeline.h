@@ -0,0 +1,76 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "image.h"
+#include "view.h"
+
+// One step of a pipeline: a processor and the parameters it runs with
+struct Operation {
+	int userChoice;
+	FilterParams params;
+};
+
+/**
+ * Runs the operations over the image in order and returns the result.
+ * Consecutive point filters are fused: each row is read once, passed through
+ * every kernel of the run while it is in cache and written once, with no
+ * intermediate images, and consecutive tone filters collapse into a single
+ * composed curve. Rotations, flips and whole scale enlarges only compose a
+ * coordinate transform (see view.h), realised by the next point filter run
+ * as it reads its rows, so a rotate then enlarge then filter is one pass.
+ */
+Image run_pipeline(const Image& image, const vector<Operation>& operations);
+
+/**
+ * Runs the operations like run_pipeline but leaves any rotations, flips and
+ * enlarges at the end unrealised, for write_view to apply as it writes. An
+ * adaptive processor met before anything but rotations and flips takes its
+ * parameters from histogram, when given and holding the parts it needs.
+ * @return A view over image, or over storage which receives the last image produced
+ */
+ImageView run_pipeline_view(const Image& image, const vector<Operation>& operations, Image& storage, const Histogram* histogram = nullptr);
+
+// Returns the HistogramParts the decoder should count for the operations: those of an adaptive processor only rotations and flips precede, else 0
+int input_histogram_parts(const vector<Operation>& operations);
+
+/**
+ * Writes a result of run_pipeline_view in the format set by set_output_format:
+ * paletted when the operations can only have produced a few colours, or
+ * whenever asked and the result has at most 256, and 24-bit otherwise.
+ * @return True if successful and false otherwise
+ */
+bool write_result(string filename, const ImageView& view, const vector<Operation>& operations);
+
+/**
+ * Runs the operations over a BMP file and writes the result. A single point
+ * filter or adaptive processor runs between memory mappings, and a single scale or a single
+ * processor on an image too large for memory is streamed; anything else is
+ * decoded and run as in run_pipeline, the writer applying any geometry left
+ * at the end. Results are written in the format set by set_output_format.
+ * @return True if the output was written and false otherwise
+ */
+bool process_file(path inputFile, path outputFile, const vector<Operation>& operations);
+
+/**
+ * Decodes a BMP file once and runs each recipe against the shared decoded
+ * image concurrently, writing the result of recipes[i] to outputFiles[i]
+ * as process_file would.
+ * @return How many outputs were written
+ */
+int process_fanout(path inputFile, const vector<path>& outputFiles, const vector<vector<Operation>>& recipes);
+
+/**
+ * Parses a comma separated list of processors such as "3,9:0.4,1" into
+ * operations. Parameters follow the processor number after colons: the
+ * scaling factor for 2, 8 and 9, the number of rotations for 5, the x and
+ * y scale for 6, the gamma for 11, the black and white points for 12, the
+ * contrast factor for 13, the radius for 16, the sigma for 17 and the sigma
+ * and amount for 18. The blurs, 18 and 19 then take a border mode: clamp,
+ * mirror or wrap. 7 takes its threshold or "auto" (Otsu), 10 its dark and
+ * light channel sums or "auto" and a clip percent, and 20 a clip percent.
+ * Parameters that are left out keep their defaults.
+ * @return True if every entry names a processor and false otherwise
+ */
+bool parse_operations(const string& spec, vector<Operation>& operations);
+
+#endif
@@ -0,0 +1,189 @@
+#include "resample.h"
+#include "kernels.h"
+#include <cstring>
+
+// Returns true if scale is a whole number of at least 1, which enlarges by replicating pixels
+bool is_whole_scale(double scale)
+{
+    return scale >= 1 && scale == floor(scale) && scale <= 65536;
+}
+
+// Returns the size of a dimension scaled by scale, at least 1 pixel, in a double so no scale overflows it
+static double scaled_extent(int size, double scale)
+{
+    double scaled = is_whole_scale(scale) ? (double)size * scale : floor(size * scale + 0.5);
+    return scaled < 1 ? 1 : scaled;
+}
+
+// Returns the size of a dimension scaled by scale, at least 1 pixel, or 0 if it would pass INT_MAX
+int scaled_size(int size, double scale)
+{
+    double scaled = scaled_extent(size, scale);
+    // False for NaN as well
+    return scaled <= INT_MAX ? (int)scaled : 0;
+}
+
+/**
+ * Checks that a scaled image stays within MAX_SCALED_BYTES as a BMP file.
+ * @param width   Width of the image in pixels
+ * @param height  Height of the image in pixels
+ * @param x_scale Horizontal scale factor
+ * @param y_scale Vertical scale factor
+ * @return True if the scaled image fits and false otherwise
+ */
+bool scale_fits(int width, int height, double x_scale, double y_scale)
+{
+    double new_width = scaled_extent(width, x_scale);
+    double new_height = scaled_extent(height, y_scale);
+    if (!(new_width <= INT_MAX && new_height <= INT_MAX)) {
+        return false;
+    }
+    double stride = ceil(new_width * 3 / 4) * 4;
+    return BMP_FILE_HEADER_SIZE + stride * new_height <= MAX_SCALED_BYTES;
+}
+
+// Nearest neighbour enlarge: replicate each pixel x_scale times and each row y_scale times
+static bool enlarge_rows(int width, int height, const RowSource& source, int x_scale, int y_scale, const RowSink& sink)
+{
+    int new_width = width * x_scale;
+    vector<unsigned char> out(bmp_encoded_size(new_width, 1) - BMP_FILE_HEADER_SIZE, 0);
+    for (int y = 0; y < height; y++) {
+        const unsigned char* in = source(y);
+        unsigned char* pixel = out.data();
+        for (int x = 0; x < width; x++) {
+            for (int i = 0; i < x_scale; i++) {
+                pixel[0] = in[3*x];
+                pixel[1] = in[3*x+1];
+                pixel[2] = in[3*x+2];
+                pixel += 3;
+            }
+        }
+        for (int i = 0; i < y_scale; i++) {
+            if (!sink(out.data())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Input pixels under one output pixel of a box filter and their shares of it
+struct BoxSpan {
+    int first;
+    vector<float> weights;
+};
+
+/**
+ * Returns, for every output position, the input positions it covers and the
+ * fraction of the output pixel each one makes up.
+ */
+static vector<BoxSpan> box_spans(int size, int new_size)
+{
+    vector<BoxSpan> spans(new_size);
+    for (int j = 0; j < new_size; j++) {
+        double begin = (double)j * size / new_size;
+        double end = (double)(j + 1) * size / new_size;
+        BoxSpan& span = spans[j];
+        span.first = (int)floor(begin);
+        for (int i = span.first; i < size && i < end; i++) {
+            double overlap = min(end, (double)(i + 1)) - max(begin, (double)i);
+            span.weights.push_back((float)(overlap / (end - begin)));
+        }
+    }
+    return spans;
+}
+
+// Area averaging resample for any other scale
+static bool box_rows(int width, int height, const RowSource& source, int new_width, int new_height, const RowSink& sink)
+{
+    vector<BoxSpan> columns = box_spans(width, new_width);
+    vector<float> scaled((size_t)new_width * 3);
+    vector<float> sum((size_t)new_width * 3, 0);
+    vector<unsigned char> out(bmp_encoded_size(new_width, 1) - BMP_FILE_HEADER_SIZE, 0);
+    int j = 0;
+    double row_begin = 0;
+    double row_end = (double)height / new_height;
+    for (int y = 0; y < height && j < new_height; y++) {
+        const unsigned char* in = source(y);
+        // Horizontal pass: the input row at the output width
+        for (int x = 0; x < new_width; x++) {
+            const BoxSpan& span = columns[x];
+            const unsigned char* pixel = in + 3 * span.first;
+            float b = 0, g = 0, r = 0;
+            for (size_t k = 0; k < span.weights.size(); k++) {
+                b += pixel[3*k]   * span.weights[k];
+                g += pixel[3*k+1] * span.weights[k];
+                r += pixel[3*k+2] * span.weights[k];
+            }
+            scaled[3*x]   = b;
+            scaled[3*x+1] = g;
+            scaled[3*x+2] = r;
+        }
+        // Vertical pass: this row's share of every output row it lies under
+        while (j < new_height) {
+            double overlap = min(row_end, (double)(y + 1)) - max(row_begin, (double)y);
+            if (overlap > 0) {
+                float weight = (float)(overlap / (row_end - row_begin));
+                for (size_t i = 0; i < sum.size(); i++) {
+                    sum[i] += scaled[i] * weight;
+                }
+            }
+            if (row_end > y + 1) {
+                break;
+            }
+            for (size_t i = 0; i < sum.size(); i++) {
+                out[i] = clamp_byte((int)(sum[i] + 0.5f));
+            }
+            if (!sink(out.data())) {
+                return false;
+            }
+            fill(sum.begin(), sum.end(), 0.0f);
+            j++;
+            row_begin = (double)j * height / new_height;
+            row_end = (double)(j + 1) * height / new_height;
+        }
+    }
+    return j == new_height;
+}
+
+/**
+ * Scales a width x height image from source to sink one row at a time.
+ * @param width   Width of the input in pixels
+ * @param height  Height of the input in pixels
+ * @param source  Supplies the input rows
+ * @param x_scale Horizontal scale factor
+ * @param y_scale Vertical scale factor
+ * @param sink    Takes the output rows
+ * @return True if the sink took every row and false otherwise
+ */
+bool scale_rows(int width, int height, const RowSource& source, double x_scale, double y_scale, const RowSink& sink)
+{
+    if (!(x_scale > 0) || !(y_scale > 0)) {
+        return false;
+    }
+    if (!scale_fits(width, height, x_scale, y_scale)) {
+        return false;
+    }
+    if (is_whole_scale(x_scale) && is_whole_scale(y_scale)) {
+        return enlarge_rows(width, height, source, (int)x_scale, (int)y_scale, sink);
+    }
+    return box_rows(width, height, source, scaled_size(width, x_scale), scaled_size(height, y_scale), sink);
+}
+
+// Scales the image (see scale_rows) and returns the resulting image
+Image scale_image(const Image& image, double x_scale, double y_scale)
+{
+    if (!scale_fits(image.width, image.height, x_scale, y_scale)) {
+        return Image();
+    }
+    Image new_image(scaled_size(image.width, x_scale), scaled_size(image.height, y_scale));
+    int y = 0;
+    bool scaled = scale_rows(image.width, image.height,
+        [&](int row) { return image.row(row); },
+        x_scale, y_scale,
+        [&](const unsigned char* row) {
+            memcpy(new_image.row(y++), row, new_image.stride);
+            return true;
+        });
+    return scaled ? new_image : Image();
+}
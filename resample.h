@@ -0,0 +1,39 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include "image.h"
+#include <climits>
+#include <functional>
+
+// Supplies input row y (bottom to top); rows are asked for in increasing order
+typedef function<const unsigned char*(int y)> RowSource;
+
+// Receives each finished output row, bottom to top; returns false to stop
+typedef function<bool(const unsigned char* row)> RowSink;
+
+// Returns true if scale is a whole number of at least 1, which enlarges by replicating pixels
+bool is_whole_scale(double scale);
+
+// Largest BMP file a scale may produce, so every size and offset in it fits in an int
+const double MAX_SCALED_BYTES = INT_MAX;
+
+// Returns the size of a dimension scaled by scale, at least 1 pixel, or 0 if it would pass INT_MAX
+int scaled_size(int size, double scale);
+
+// Returns true if scaling a width x height image gives a BMP of at most MAX_SCALED_BYTES
+bool scale_fits(int width, int height, double x_scale, double y_scale);
+
+/**
+ * Scales a width x height image from source to sink one row at a time.
+ * Whole number scales replicate pixels like process_6: each output row is
+ * built once and handed to the sink y_scale times. Any other scale, up or
+ * down, averages the input area under each output pixel (box filter),
+ * holding one horizontally scaled input row and one accumulating output row.
+ * @return True if the sink took every row and false otherwise
+ */
+bool scale_rows(int width, int height, const RowSource& source, double x_scale, double y_scale, const RowSink& sink);
+
+// Scales the image (see scale_rows) and returns the resulting image
+Image scale_image(const Image& image, double x_scale, double y_scale);
+
+#endif
@@ -0,0 +1,382 @@
+#include "result_cache.h"
+#include "indexed_bmp.h"
+#include "kernels.h"
+#include "parallel.h"
+#include <atomic>
+#include <cstring>
+#include <list>
+#include <sstream>
+#include <unordered_map>
+
+// Bump when a change to a processor alters its output, so old results are no longer found
+const int CACHE_VERSION = 1;
+
+// Rows hashed as one block; fixed so keys do not depend on the thread count
+const int HASH_BLOCK_ROWS = 64;
+
+// A cached result: its size and its place in the recency order
+struct CacheEntry {
+    uint64_t bytes;
+    list<string>::iterator position;
+};
+
+// Results by key, most recently used at the front of order
+struct ResultCache {
+    mutex lock;
+    bool enabled = false;
+    bool link = false;
+    path dir;
+    uint64_t limit = DEFAULT_CACHE_LIMIT;
+    uint64_t bytes = 0;
+    list<string> order;
+    unordered_map<string, CacheEntry> entries;
+    atomic<uint64_t> hits{ 0 };
+    atomic<uint64_t> misses{ 0 };
+    atomic<uint64_t> temp_count{ 0 };
+};
+
+static ResultCache& cache()
+{
+    static ResultCache* instance = new ResultCache();
+    return *instance;
+}
+
+static const uint64_t PRIME_1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME_3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t PRIME_5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotate_left(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t read_64(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME_2;
+    return rotate_left(acc, 31) * PRIME_1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= hash_round(0, value);
+    return acc * PRIME_1 + PRIME_4;
+}
+
+/**
+ * Hashes size bytes from data in the manner of xxHash64: four independent
+ * lanes take 32 bytes per step, then the tail and a final avalanche.
+ * @param data The bytes to hash
+ * @param size How many bytes
+ * @param seed Starting value, so one set of bytes can give unrelated hashes
+ * @return The hash
+ */
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v1 = seed + PRIME_1 + PRIME_2;
+        uint64_t v2 = seed + PRIME_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME_1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = hash_round(v1, read_64(p));
+            v2 = hash_round(v2, read_64(p + 8));
+            v3 = hash_round(v3, read_64(p + 16));
+            v4 = hash_round(v4, read_64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) + rotate_left(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else {
+        h = seed + PRIME_5;
+    }
+    h += size;
+    while (p + 8 <= end) {
+        h ^= hash_round(0, read_64(p));
+        h = rotate_left(h, 27) * PRIME_1 + PRIME_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        h ^= word * PRIME_1;
+        h = rotate_left(h, 23) * PRIME_2 + PRIME_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= *p * PRIME_5;
+        h = rotate_left(h, 11) * PRIME_1;
+        p++;
+    }
+    h ^= h >> 33;
+    h *= PRIME_2;
+    h ^= h >> 29;
+    h *= PRIME_3;
+    h ^= h >> 32;
+    return h;
+}
+
+// Hashes the pixels of the image a block of rows per task, then the block hashes in order
+uint64_t hash_pixels(const Image& image)
+{
+    int blocks = (image.height + HASH_BLOCK_ROWS - 1) / HASH_BLOCK_ROWS;
+    vector<uint64_t> block_hashes(blocks);
+    // Row padding is zero in every Image, so whole rows can be hashed
+    parallel_rows(blocks, image.stride * HASH_BLOCK_ROWS, [&](int first, int last) {
+        for (int b = first; b < last; b++) {
+            int rows = min(HASH_BLOCK_ROWS, image.height - b * HASH_BLOCK_ROWS);
+            block_hashes[b] = hash_bytes(image.row(b * HASH_BLOCK_ROWS), image.stride * rows, b);
+        }
+    });
+    uint64_t seed = (uint64_t)image.width << 32 | (uint32_t)image.height;
+    return hash_bytes(block_hashes.data(), block_hashes.size() * sizeof(uint64_t), seed);
+}
+
+// Returns the file holding the result for key
+static path entry_path(const ResultCache& state, const string& key)
+{
+    return state.dir / (key + ".bmp");
+}
+
+// Whether a file name in the cache directory is a result, as named by entry_path
+static bool is_entry_name(const string& name)
+{
+    if (name.size() != 37 || name.compare(33, 4, ".bmp") != 0 || name[16] != '-') {
+        return false;
+    }
+    for (int i = 0; i < 33; i++) {
+        if (i != 16 && !isxdigit((unsigned char)name[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Deletes least recently used results until the cache is within its limit; the caller holds the lock
+static void evict(ResultCache& state)
+{
+    while (state.bytes > state.limit && !state.order.empty()) {
+        string key = state.order.back();
+        error_code ec;
+        remove(entry_path(state, key), ec);
+        state.bytes -= state.entries[key].bytes;
+        state.entries.erase(key);
+        state.order.pop_back();
+    }
+}
+
+/**
+ * Opens the result cache in dir, taking in the results already there,
+ * oldest modification time first so recency carries over between runs.
+ * @param dir   Where the cached results live
+ * @param limit Most bytes of results to keep
+ * @param link  Hard link hits to the output instead of copying them
+ * @return True if the cache is usable and false otherwise
+ */
+bool open_result_cache(const path& dir, uint64_t limit, bool link)
+{
+    error_code ec;
+    create_directories(dir, ec);
+    if (!is_directory(dir, ec)) {
+        return false;
+    }
+    vector<pair<file_time_type, path>> found;
+    for (const directory_entry& entry : directory_iterator(dir, ec)) {
+        string name = entry.path().filename().string();
+        if (entry.path().extension() == ".tmp") {
+            // Left by a run that stopped while storing
+            remove(entry.path(), ec);
+        }
+        else if (entry.is_regular_file(ec) && is_entry_name(name)) {
+            found.push_back(make_pair(entry.last_write_time(ec), entry.path()));
+        }
+    }
+    sort(found.begin(), found.end());
+
+    ResultCache& state = cache();
+    lock_guard<mutex> guard(state.lock);
+    state.dir = dir;
+    state.limit = limit;
+    state.link = link;
+    state.bytes = 0;
+    state.order.clear();
+    state.entries.clear();
+    for (size_t i = 0; i < found.size(); i++) {
+        string key = found[i].second.stem().string();
+        uint64_t bytes = file_size(found[i].second, ec);
+        if (ec) {
+            continue;
+        }
+        state.order.push_front(key);
+        state.entries[key] = CacheEntry{ bytes, state.order.begin() };
+        state.bytes += bytes;
+    }
+    evict(state);
+    state.enabled = true;
+    return true;
+}
+
+// Returns whether open_result_cache has been called successfully
+bool result_cache_enabled()
+{
+    return cache().enabled;
+}
+
+/**
+ * Returns the key of the result of running the operations over the image:
+ * the hash of the pixels and the hash of a description of the processors,
+ * all their parameters (exactly, as hex floats), the output format and
+ * the arithmetic (see set_fixed_point).
+ * @param pixels     The hash_pixels of the decoded input
+ * @param operations The processors to run
+ * @return A key of 33 characters, usable as a file name
+ */
+string result_key(uint64_t pixels, const vector<Operation>& operations)
+{
+    stringstream recipe;
+    recipe << hexfloat << "v" << CACHE_VERSION << " format " << output_format() << " fixed " << fixed_point();
+    for (size_t i = 0; i < operations.size(); i++) {
+        const FilterParams& params = operations[i].params;
+        recipe << " " << operations[i].userChoice << ":" << params.scaling_factor << ":" << params.rotations
+               << ":" << params.x_scale << ":" << params.y_scale << ":" << params.gamma
+               << ":" << params.black_point << ":" << params.white_point << ":" << params.contrast
+               << ":" << params.radius << ":" << params.sigma << ":" << params.amount << ":" << params.border
+               << ":" << params.threshold << ":" << params.dark_sum << ":" << params.light_sum
+               << ":" << params.automatic << ":" << params.clip;
+    }
+    string description = recipe.str();
+    char key[40];
+    snprintf(key, sizeof(key), "%016llx-%016llx", (unsigned long long)pixels,
+             (unsigned long long)hash_bytes(description.data(), description.size(), CACHE_VERSION));
+    return key;
+}
+
+// Returns the key of the result of running the operations over the image in the current output format
+string result_key(const Image& image, const vector<Operation>& operations)
+{
+    return result_key(hash_pixels(image), operations);
+}
+
+// Puts the file at target by hard link or copy, replacing what is there
+static bool place_file(const path& source, const path& target, bool link)
+{
+    error_code ec;
+    remove(target, ec);
+    if (link) {
+        create_hard_link(source, target, ec);
+        if (!ec) {
+            return true;
+        }
+    }
+    ec.clear();
+    copy_file(source, target, copy_options::overwrite_existing, ec);
+    return !ec;
+}
+
+/**
+ * Puts the result cached for key at outputFile and marks it most recently used.
+ * @param key        The key from result_key
+ * @param outputFile Where the result goes
+ * @return True on a hit and false on a miss
+ */
+bool fetch_result(const string& key, const path& outputFile)
+{
+    ResultCache& state = cache();
+    path source;
+    bool link;
+    {
+        lock_guard<mutex> guard(state.lock);
+        unordered_map<string, CacheEntry>::iterator entry = state.entries.find(key);
+        if (!state.enabled || entry == state.entries.end()) {
+            state.misses++;
+            return false;
+        }
+        state.order.splice(state.order.begin(), state.order, entry->second.position);
+        source = entry_path(state, key);
+        link = state.link;
+    }
+    if (!place_file(source, outputFile, link)) {
+        // Deleted behind our back; forget it
+        lock_guard<mutex> guard(state.lock);
+        unordered_map<string, CacheEntry>::iterator entry = state.entries.find(key);
+        if (entry != state.entries.end()) {
+            state.bytes -= entry->second.bytes;
+            state.order.erase(entry->second.position);
+            state.entries.erase(entry);
+        }
+        state.misses++;
+        return false;
+    }
+    error_code ec;
+    last_write_time(source, file_time_type::clock::now(), ec);
+    state.hits++;
+    return true;
+}
+
+/**
+ * Adds the written outputFile as the result for key. The file is placed
+ * under a temporary name and renamed, so a cached result is never partial.
+ * @param key        The key from result_key
+ * @param outputFile The result as written
+ */
+void store_result(const string& key, const path& outputFile)
+{
+    ResultCache& state = cache();
+    error_code ec;
+    uint64_t bytes = file_size(outputFile, ec);
+    if (!state.enabled || ec || bytes > state.limit) {
+        return;
+    }
+    path target = entry_path(state, key);
+    path temp = state.dir / (key + "." + to_string(state.temp_count++) + ".tmp");
+    if (!place_file(outputFile, temp, state.link)) {
+        remove(temp, ec);
+        return;
+    }
+    lock_guard<mutex> guard(state.lock);
+    rename(temp, target, ec);
+    if (ec) {
+        remove(temp, ec);
+        return;
+    }
+    unordered_map<string, CacheEntry>::iterator entry = state.entries.find(key);
+    if (entry != state.entries.end()) {
+        // Two files with the same pixels missed at once; the newer copy replaced the older
+        state.bytes -= entry->second.bytes;
+        state.order.erase(entry->second.position);
+        state.entries.erase(entry);
+    }
+    state.order.push_front(key);
+    state.entries[key] = CacheEntry{ bytes, state.order.begin() };
+    state.bytes += bytes;
+    evict(state);
+}
+
+// Returns the counts of the result cache
+CacheStats result_cache_stats()
+{
+    ResultCache& state = cache();
+    CacheStats stats;
+    lock_guard<mutex> guard(state.lock);
+    stats.hits = state.hits;
+    stats.misses = state.misses;
+    stats.entries = state.entries.size();
+    stats.bytes = state.bytes;
+    return stats;
+}
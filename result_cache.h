@@ -0,0 +1,63 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "image.h"
+#include "pipeline.h"
+
+/**
+ * On-disk cache of processed BMP files, keyed by a hash of the input pixels
+ * and of the processors, their parameters and the output format. A hit puts
+ * the cached file at the output path instead of filtering and encoding
+ * again; the input is still decoded to hash it. The cache holds at most a
+ * given number of bytes, evicting the least recently used results, and
+ * remembers recency across runs through the files' modification times.
+ */
+
+// Counts of the result cache since it was opened
+struct CacheStats {
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t entries = 0; // results held
+	uint64_t bytes = 0;   // size of the results held
+};
+
+// Default size bound of the result cache
+const uint64_t DEFAULT_CACHE_LIMIT = (uint64_t)1 << 30;
+
+/**
+ * Opens the result cache in dir, creating the directory if needed, for
+ * process_file and the batch pipeline to use from then on.
+ * @param dir   Where the cached results live
+ * @param limit Most bytes of results to keep
+ * @param link  Hard link hits to the output instead of copying them; the
+ *              output then shares its storage with the cache, so it must be
+ *              replaced rather than rewritten in place
+ * @return True if the cache is usable and false otherwise
+ */
+bool open_result_cache(const path& dir, uint64_t limit, bool link);
+
+// Returns whether open_result_cache has been called successfully
+bool result_cache_enabled();
+
+// Hashes size bytes from data (64-bit, xxHash64 style)
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed);
+
+// Hashes the pixels and dimensions of the image, in parallel across the filter threads
+uint64_t hash_pixels(const Image& image);
+
+// Returns the key of the result of running the operations over the image in the current output format
+string result_key(const Image& image, const vector<Operation>& operations);
+
+// Returns the key as above from the hash_pixels of the image, for running several recipes over one image
+string result_key(uint64_t pixels, const vector<Operation>& operations);
+
+// Puts the result cached for key at outputFile; false, counted as a miss, if there is none
+bool fetch_result(const string& key, const path& outputFile);
+
+// Adds the written outputFile as the result for key, evicting the least recently used results over the limit
+void store_result(const string& key, const path& outputFile);
+
+// Returns the counts of the result cache
+CacheStats result_cache_stats();
+
+#endif
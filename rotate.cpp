@@ -0,0 +1,118 @@
+#include "rotate.h"
+#include "parallel.h"
+
+// Side of the square tiles transposed at a time; 32 rows of 96 bytes stay in L1
+const int TILE = 32;
+
+// Copies one pixel
+static inline void copy_pixel(const unsigned char* in, unsigned char* out)
+{
+    out[0] = in[0];
+    out[1] = in[1];
+    out[2] = in[2];
+}
+
+/**
+ * Quarter turn clockwise (quarter_turns 1) or counter-clockwise (3) as a
+ * tiled transpose: each TILE x TILE block of output pixels reads a TILE x TILE
+ * block of input pixels, so both sides stay in cache.
+ */
+static Image rotate_quarter(const Image& image, int quarter_turns)
+{
+    int width = image.width;
+    int height = image.height;
+    Image new_image(height, width);
+    int tile_rows = (width + TILE - 1) / TILE;
+    parallel_rows(tile_rows, new_image.stride * TILE, [&](int first, int last) {
+        for (int y0 = first * TILE; y0 < min(last * TILE, width); y0 += TILE) {
+            int y1 = min(y0 + TILE, width);
+            for (int x0 = 0; x0 < height; x0 += TILE) {
+                int x1 = min(x0 + TILE, height);
+                for (int y = y0; y < y1; y++) {
+                    unsigned char* out = new_image.row(y);
+                    if (quarter_turns == 1) {
+                        // out(x, y) = in(width - 1 - y, x)
+                        const unsigned char* in = image.row(0) + 3 * (width - 1 - y);
+                        for (int x = x0; x < x1; x++) {
+                            copy_pixel(in + image.stride * x, out + 3 * x);
+                        }
+                    }
+                    else {
+                        // out(x, y) = in(y, height - 1 - x)
+                        const unsigned char* in = image.row(0) + 3 * y;
+                        for (int x = x0; x < x1; x++) {
+                            copy_pixel(in + image.stride * (height - 1 - x), out + 3 * x);
+                        }
+                    }
+                }
+            }
+        }
+    });
+    return new_image;
+}
+
+// Half turn: output row y is input row height - 1 - y read backwards
+static Image rotate_half(const Image& image)
+{
+    int width = image.width;
+    int height = image.height;
+    Image new_image(width, height);
+    parallel_rows(height, image.stride, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            const unsigned char* in = image.row(height - 1 - y);
+            unsigned char* out = new_image.row(y);
+            for (int x = 0; x < width; x++) {
+                copy_pixel(in + 3 * (width - 1 - x), out + 3 * x);
+            }
+        }
+    });
+    return new_image;
+}
+
+/**
+ * Rotates the image by quarter_turns times 90 degrees clockwise in a single pass.
+ * @param image         The input image
+ * @param quarter_turns Number of clockwise quarter turns, taken modulo 4
+ * @return The rotated image
+ */
+Image rotate_image(const Image& image, int quarter_turns)
+{
+    quarter_turns = ((quarter_turns % 4) + 4) % 4;
+    switch (quarter_turns) {
+    case 1:
+    case 3:
+        return rotate_quarter(image, quarter_turns);
+    case 2:
+        return rotate_half(image);
+    }
+    return image;
+}
+
+// Reverses the order of the pixels in a row
+static void reverse_pixels(unsigned char* row, int width)
+{
+    for (int left = 0, right = width - 1; left < right; left++, right--) {
+        swap_ranges(row + 3 * left, row + 3 * left + 3, row + 3 * right);
+    }
+}
+
+// Mirrors the image left to right in place
+void flip_horizontal(Image& image)
+{
+    parallel_rows(image.height, image.stride, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            reverse_pixels(image.row(y), image.width);
+        }
+    });
+}
+
+// Mirrors the image top to bottom in place
+void flip_vertical(Image& image)
+{
+    int height = image.height;
+    parallel_rows(height / 2, image.stride * 2, [&](int first, int last) {
+        for (int y = first; y < last; y++) {
+            swap_ranges(image.row(y), image.row(y) + image.stride, image.row(height - 1 - y));
+        }
+    });
+}
@@ -0,0 +1,20 @@
+#ifndef ROTATE_H
+#define ROTATE_H
+
+#include "image.h"
+
+/**
+ * Rotates the image by quarter_turns times 90 degrees clockwise in a single
+ * pass, whatever the number of turns: it is taken modulo 4 (negative counts
+ * turn counter-clockwise). Quarter turns are a transpose done in cache-sized
+ * tiles; a half turn reverses the rows and the pixels within them.
+ */
+Image rotate_image(const Image& image, int quarter_turns);
+
+// Mirrors the image left to right in place
+void flip_horizontal(Image& image);
+
+// Mirrors the image top to bottom in place
+void flip_vertical(Image& image);
+
+#endif
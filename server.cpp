@@ -0,0 +1,463 @@
+#include "server.h"
+#include "pipeline.h"
+#include "batch.h"
+#include "threadpool.h"
+#include "parallel.h"
+#include "tone.h"
+#include "indexed_bmp.h"
+#include "result_cache.h"
+#include "kernels.h"
+#include "metrics.h"
+#include "io_pipeline.h"
+#include <cerrno>
+#include <chrono>
+#include <future>
+#include <set>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+// Server state shared by the connection threads
+struct Server {
+    int listen_fd = -1;
+    ThreadPool* pool = nullptr;
+    atomic<bool> stopping{ false };
+    atomic<int> jobs{ 0 };
+    atomic<int> failed{ 0 };
+    mutex lock;
+    condition_variable finished;
+    set<int> clients; // connections being served
+};
+
+// Sends the whole line and a newline; returns false if the peer has gone
+static bool send_line(int fd, const string& line)
+{
+    string data = line + "\n";
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * Takes the next line out of buffer, receiving more data while there is no
+ * complete line in it.
+ * @return True if a line was read and false at the end of the stream
+ */
+static bool read_line(int fd, string& buffer, string& line)
+{
+    size_t end = buffer.find('\n');
+    while (end == string::npos) {
+        char chunk[4096];
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buffer.append(chunk, (size_t)n);
+        end = buffer.find('\n');
+    }
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+    }
+    return true;
+}
+
+// Returns a future that already holds the response
+static future<string> ready(const string& response)
+{
+    promise<string> answer;
+    answer.set_value(response);
+    return answer.get_future();
+}
+
+// Queues the job on the pool and returns its future response
+static future<string> submit_job(Server& server, const string& request)
+{
+    stringstream fields(request);
+    string list;
+    string inputFile;
+    string outputFile;
+    vector<Operation> operations;
+    if (!getline(fields, list, '\t') || !getline(fields, inputFile, '\t') || !getline(fields, outputFile)
+        || !parse_operations(list, operations)) {
+        return ready("ERROR expected LIST<TAB>INPUT<TAB>OUTPUT");
+    }
+    shared_ptr<promise<string>> answer = make_shared<promise<string>>();
+    chrono::steady_clock::time_point queued = chrono::steady_clock::now();
+    server.pool->submit([&server, answer, operations, inputFile, outputFile, queued] {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        bool written = process_file(inputFile, outputFile, operations);
+        chrono::steady_clock::time_point end = chrono::steady_clock::now();
+        server.jobs++;
+        if (!written) {
+            server.failed++;
+            answer->set_value("ERROR could not process " + inputFile);
+            return;
+        }
+        stringstream response;
+        response << "OK wait_ms=" << chrono::duration<double, milli>(start - queued).count()
+                 << " run_ms=" << chrono::duration<double, milli>(end - start).count();
+        answer->set_value(response.str());
+    });
+    return answer->get_future();
+}
+
+// Stops accepting connections and ends the idle ones
+static void stop_server(Server& server)
+{
+    server.stopping = true;
+    shutdown(server.listen_fd, SHUT_RDWR);
+    lock_guard<mutex> guard(server.lock);
+    for (int fd : server.clients) {
+        shutdown(fd, SHUT_RD);
+    }
+}
+
+// Responses a connection may have waiting to be sent before it stops reading requests
+const size_t MAX_PENDING_RESPONSES = 4096;
+
+// Sends the responses of a connection in the order of the requests, as each is ready
+static void send_responses(int fd, BoundedQueue<function<string()>>& responses)
+{
+    function<string()> response;
+    bool connected = true;
+    while (responses.pop(response)) {
+        // Still wait for the answer when the client has gone, so jobs never outlive their connection
+        string line = response();
+        connected = connected && send_line(fd, line);
+    }
+}
+
+/**
+ * Serves one client. Requests are queued as they arrive and a writer thread
+ * sends each response as soon as it and those before it are ready, so
+ * reading requests never waits on a job and a client that sends many jobs
+ * at once has them all running together.
+ */
+static void serve_client(Server& server, int fd)
+{
+    string buffer;
+    string line;
+    BoundedQueue<function<string()>> responses(MAX_PENDING_RESPONSES);
+    thread writer(send_responses, fd, ref(responses));
+    bool open = true;
+    while (open && read_line(fd, buffer, line)) {
+        if (line == "PING") {
+            responses.push([] { return string("PONG"); });
+        }
+        else if (line == "STATS") {
+            // Counted when it is sent, after this client's earlier jobs have finished
+            responses.push([&server] {
+                string stats = "STATS jobs=" + to_string(server.jobs.load()) + " failed=" + to_string(server.failed.load());
+                if (result_cache_enabled()) {
+                    CacheStats cache = result_cache_stats();
+                    stats += " cache_hits=" + to_string(cache.hits) + " cache_misses=" + to_string(cache.misses);
+                }
+                return stats;
+            });
+        }
+        else if (line == "SHUTDOWN") {
+            responses.push([] { return string("BYE"); });
+            open = false;
+        }
+        else if (!line.empty()) {
+            shared_ptr<future<string>> answer = make_shared<future<string>>(submit_job(server, line));
+            responses.push([answer] { return answer->get(); });
+        }
+    }
+    responses.close();
+    writer.join();
+    if (!open) {
+        stop_server(server);
+    }
+    // The server may be gone once the last client is erased, so this is the last use of it
+    lock_guard<mutex> guard(server.lock);
+    server.clients.erase(fd);
+    close(fd);
+    server.finished.notify_all();
+}
+
+/**
+ * Serves jobs until a client sends SHUTDOWN.
+ * @param options The socket to listen on and the threads to use
+ * @return The process exit status
+ */
+int run_server(const ServerOptions& options)
+{
+    string socketPath = options.socketPath.string();
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path must be 1 to " << sizeof(address.sun_path) - 1 << " characters" << endl;
+        return 1;
+    }
+    socketPath.copy(address.sun_path, socketPath.size());
+
+    // A socket left behind by a server that did not shut down cleanly
+    error_code ec;
+    if (is_socket(options.socketPath, ec)) {
+        remove(options.socketPath, ec);
+    }
+
+    Server server;
+    server.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server.listen_fd < 0 || bind(server.listen_fd, (sockaddr*)&address, sizeof(address)) != 0
+        || listen(server.listen_fd, 64) != 0) {
+        std::cerr << "Could not listen on " << socketPath << endl;
+        if (server.listen_fd >= 0) {
+            close(server.listen_fd);
+        }
+        return 1;
+    }
+
+    // Start the filter threads and the default curves now rather than on the first job
+    set_filter_threads(options.imageThreads);
+    parallel_rows(filter_threads(), (size_t)1 << 20, [](int, int) {});
+    FilterParams defaults;
+    tone_curve(8, defaults);
+    tone_curve(9, defaults);
+
+    ThreadPool pool(options.threads);
+    server.pool = &pool;
+    std::cout << "Serving on " << socketPath << " with " << pool.size() << " job threads" << endl;
+
+    while (!server.stopping) {
+        int fd = accept(server.listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            break;
+        }
+        lock_guard<mutex> guard(server.lock);
+        if (server.stopping) {
+            close(fd);
+            break;
+        }
+        server.clients.insert(fd);
+        thread(serve_client, ref(server), fd).detach();
+    }
+    {
+        unique_lock<mutex> guard(server.lock);
+        server.finished.wait(guard, [&] { return server.clients.empty(); });
+    }
+    pool.wait();
+    close(server.listen_fd);
+    remove(options.socketPath, ec);
+    std::cout << "Served " << server.jobs << " jobs (" << server.failed << " failed)" << endl;
+    METRICS_REPORT();
+    return 0;
+}
+
+// Connects to the server at socketPath; returns the socket or -1
+static int connect_server(const path& socketPath)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    string name = socketPath.string();
+    if (name.empty() || name.size() >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    name.copy(address.sun_path, name.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * Sends the requests from a separate thread while reading a response for
+ * each, so neither side waits for the other to drain its socket.
+ * @return The responses, which are fewer than the requests if the server went away
+ */
+static vector<string> send_requests(int fd, const vector<string>& requests)
+{
+    thread sender([fd, &requests] {
+        for (size_t i = 0; i < requests.size(); i++) {
+            if (!send_line(fd, requests[i])) {
+                break;
+            }
+        }
+        shutdown(fd, SHUT_WR);
+    });
+    vector<string> responses;
+    string buffer;
+    string line;
+    while (responses.size() < requests.size() && read_line(fd, buffer, line)) {
+        responses.push_back(line);
+    }
+    // Unblocks the sender if the server went away
+    shutdown(fd, SHUT_RDWR);
+    sender.join();
+    return responses;
+}
+
+#else
+
+// No Unix domain sockets here
+int run_server(const ServerOptions& options)
+{
+    std::cerr << "The job server needs Unix domain sockets" << endl;
+    return 1;
+}
+
+static int connect_server(const path& socketPath) { return -1; }
+static vector<string> send_requests(int fd, const vector<string>& requests) { return vector<string>(); }
+
+#endif
+
+static void print_usage()
+{
+    std::cout << "Usage: main --serve SOCKET [--threads N] [--image-threads N] [--format FORMAT]" << endl
+              << "                    [--cache DIR] [--cache-size MB] [--cache-link] [--fixed-point]" << endl
+              << "       main --client SOCKET --filter LIST [--output-dir DIR] FILE_OR_DIR..." << endl
+              << "       main --client SOCKET --shutdown" << endl
+              << "  The server runs jobs sent by clients on a persistent thread pool until" << endl
+              << "  a client sends --shutdown; outputs are named and encoded as in batch mode" << endl;
+}
+
+// Sends a job per file, running the processors filter, and prints the responses; returns the process exit status
+static int run_client(const path& socketPath, const string& filter, const BatchOptions& options, const vector<string>& inputs, bool stop)
+{
+    vector<string> requests;
+    vector<path> files = collect_inputs(inputs);
+    for (size_t i = 0; i < files.size(); i++) {
+        // The server has its own working directory
+        path inputFile = absolute(files[i]);
+        path outputFile = absolute(batch_output_path(files[i], options));
+        requests.push_back(filter + "\t" + inputFile.string() + "\t" + outputFile.string());
+    }
+    if (stop) {
+        requests.push_back("SHUTDOWN");
+    }
+    if (requests.empty()) {
+        print_usage();
+        return 1;
+    }
+
+    int fd = connect_server(socketPath);
+    if (fd < 0) {
+        std::cerr << "Could not connect to " << socketPath.string() << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<string> responses = send_requests(fd, requests);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+#ifndef _WIN32
+    close(fd);
+#endif
+
+    int failed = 0;
+    for (size_t i = 0; i < requests.size(); i++) {
+        string response = i < responses.size() ? responses[i] : "ERROR no response";
+        if (i < files.size()) {
+            std::cout << files[i].string() << ": " << response << endl;
+        }
+        if (response.compare(0, 2, "OK") != 0 && response != "BYE") {
+            failed++;
+        }
+    }
+    if (!files.empty()) {
+        std::cout << "Sent " << files.size() << " jobs (" << failed << " failed) in " << seconds << " s" << endl;
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+/**
+ * Runs the server or the client from command line arguments.
+ * @param argc Argument count
+ * @param argv Arguments
+ * @return The process exit status
+ */
+int server_main(int argc, char* argv[])
+{
+    ServerOptions server;
+    BatchOptions options;
+    vector<string> inputs;
+    string filter;
+    path clientSocket;
+    bool stop = false;
+    path cacheDir;
+    uint64_t cacheLimit = DEFAULT_CACHE_LIMIT;
+    bool cacheLink = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--serve" && has_value) {
+            server.socketPath = argv[++i];
+        }
+        else if (arg == "--client" && has_value) {
+            clientSocket = argv[++i];
+        }
+        else if (arg == "--threads" && has_value) {
+            server.threads = atoi(argv[++i]);
+        }
+        else if (arg == "--image-threads" && has_value) {
+            server.imageThreads = atoi(argv[++i]);
+        }
+        else if (arg == "--filter" && has_value) {
+            filter = argv[++i];
+        }
+        else if (arg == "--output-dir" && has_value) {
+            options.outputDir = argv[++i];
+        }
+        else if (arg == "--format" && has_value) {
+            OutputFormat format;
+            if (!parse_output_format(argv[++i], format)) {
+                print_usage();
+                return 1;
+            }
+            set_output_format(format);
+        }
+        else if (arg == "--cache" && has_value) {
+            cacheDir = argv[++i];
+        }
+        else if (arg == "--cache-size" && has_value) {
+            cacheLimit = strtoull(argv[++i], nullptr, 10) << 20;
+        }
+        else if (arg == "--cache-link") {
+            cacheLink = true;
+        }
+        else if (arg == "--fixed-point") {
+            set_fixed_point(true);
+        }
+        else if (arg == "--shutdown") {
+            stop = true;
+        }
+        else if (arg.size() > 1 && arg[0] == '-') {
+            print_usage();
+            return 1;
+        }
+        else {
+            inputs.push_back(arg);
+        }
+    }
+    if (!server.socketPath.empty()) {
+        if (!cacheDir.empty() && !open_result_cache(cacheDir, cacheLimit, cacheLink)) {
+            std::cerr << "Could not use " << cacheDir.string() << " as a result cache" << endl;
+            return 1;
+        }
+        return run_server(server);
+    }
+    if (clientSocket.empty() || (!inputs.empty() && !parse_operations(filter, options.operations))) {
+        print_usage();
+        return 1;
+    }
+    options.processName = process_name(options.operations);
+    return run_client(clientSocket, filter, options, inputs, stop);
+}
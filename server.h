@@ -0,0 +1,41 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "image.h"
+
+/**
+ * Job server on a Unix domain socket. Clients send one request per line and
+ * get one response line per request, in the order sent:
+ *   LIST<TAB>INPUT<TAB>OUTPUT  runs the processors LIST (as for --filter) on
+ *                              INPUT and writes OUTPUT; answers
+ *                              "OK wait_ms=W run_ms=R" or "ERROR message"
+ *   PING                       answers "PONG"
+ *   STATS                      answers "STATS jobs=N failed=F", followed by
+ *                              " cache_hits=H cache_misses=M" with --cache
+ *   SHUTDOWN                   answers "BYE" and stops the server
+ * Paths are taken relative to the server's working directory. Jobs run on
+ * one persistent thread pool, so the tone curve and vignette mask caches and
+ * the filter threads stay warm from one job to the next.
+ */
+
+// Options of a job server
+struct ServerOptions {
+	path socketPath;
+	int threads = 0;      // jobs run at once, 0 for one per hardware thread
+	int imageThreads = 1; // threads each filter may use, 0 for one per hardware thread
+};
+
+// Serves jobs until a client sends SHUTDOWN; returns the process exit status
+int run_server(const ServerOptions& options);
+
+/**
+ * Runs the server or the client from command line arguments, for example
+ *   main --serve /tmp/images.sock --threads 4
+ *   main --client /tmp/images.sock --filter 3,9:0.4 --output-dir out/ scans/
+ *   main --client /tmp/images.sock --shutdown
+ * The client sends a job per file, all at once, and prints each response.
+ * @return The process exit status
+ */
+int server_main(int argc, char* argv[]);
+
+#endif
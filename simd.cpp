@@ -0,0 +1,103 @@
+#include "simd.h"
+#include <cstring>
+
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SIMD_KERNELS 1
+#endif
+
+#ifdef HAVE_SIMD_KERNELS
+
+// One copy of the kernels per instruction set, each compiled for its target. Multiplies and adds
+// are never fused, whatever the build flags, so every copy gives the bytes of the scalar kernels
+#pragma GCC push_options
+#pragma GCC optimize("O3")
+#pragma GCC optimize("fp-contract=off")
+#pragma GCC target("sse4.1")
+namespace sse41 {
+#include "simd_kernels.inc"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC optimize("O3")
+#pragma GCC optimize("fp-contract=off")
+#pragma GCC target("avx2")
+namespace avx2 {
+#include "simd_kernels.inc"
+}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC optimize("O3")
+#pragma GCC optimize("fp-contract=off")
+#pragma GCC target("avx512f,avx512bw")
+namespace avx512 {
+#include "simd_kernels.inc"
+}
+#pragma GCC pop_options
+
+#endif
+
+// Returns the best instruction set this CPU supports (checked once with CPUID)
+SimdLevel detect_simd_level()
+{
+#ifdef HAVE_SIMD_KERNELS
+    static SimdLevel detected = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+            return SIMD_AVX512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return SIMD_AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return SIMD_SSE41;
+        }
+        return SIMD_SCALAR;
+    }();
+    return detected;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+static int selected_level = -1;
+
+// Returns the instruction set the kernels are dispatched to
+SimdLevel simd_level()
+{
+    return selected_level < 0 ? detect_simd_level() : (SimdLevel)selected_level;
+}
+
+// Dispatches to the given instruction set instead, capped at what the CPU supports
+void set_simd_level(SimdLevel level)
+{
+    selected_level = min(level, detect_simd_level());
+}
+
+// Returns the name of an instruction set, e.g. "avx2"
+string simd_level_name(SimdLevel level)
+{
+    switch (level) {
+    case SIMD_SSE41:  return "sse4.1";
+    case SIMD_AVX2:   return "avx2";
+    case SIMD_AVX512: return "avx512";
+    default:          return "scalar";
+    }
+}
+
+// Returns the vectorized kernel of a point filter for the current instruction set, or nullptr
+RowKernel simd_kernel(int userChoice)
+{
+#ifdef HAVE_SIMD_KERNELS
+    switch (simd_level()) {
+    case SIMD_AVX512: return avx512::kernel_for(userChoice);
+    case SIMD_AVX2:   return avx2::kernel_for(userChoice);
+    case SIMD_SSE41:
+        // With two double lanes the vectorized claredon loses to the scalar one
+        return userChoice == 2 && !fixed_point() ? nullptr : sse41::kernel_for(userChoice);
+    default:          break;
+    }
+#endif
+    return nullptr;
+}
@@ -0,0 +1,29 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "kernels.h"
+
+// Instruction sets the point filter kernels are built for, slowest first
+enum SimdLevel {
+	SIMD_SCALAR,
+	SIMD_SSE41,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+// Returns the best instruction set this CPU supports (checked once with CPUID)
+SimdLevel detect_simd_level();
+
+// Returns the instruction set the kernels are dispatched to
+SimdLevel simd_level();
+
+// Dispatches to the given instruction set instead, capped at what the CPU supports
+void set_simd_level(SimdLevel level);
+
+// Returns the name of an instruction set, e.g. "avx2"
+string simd_level_name(SimdLevel level);
+
+// Returns the vectorized kernel of a point filter for the current instruction set, or nullptr
+RowKernel simd_kernel(int userChoice);
+
+#endif
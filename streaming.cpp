@@ -0,0 +1,323 @@
+#include "streaming.h"
+#include "kernels.h"
+#include "parallel.h"
+#include "resample.h"
+#include "metrics.h"
+#include <cstring>
+
+// An open BMP file being read band by band
+struct BandReader {
+    fstream stream;
+    BmpInfo info;
+    size_t stride;
+};
+
+// Returns how many rows of the given stride fit in band_bytes (at least one)
+static int band_rows(size_t stride, int rows, size_t band_bytes)
+{
+    size_t count = band_bytes / stride;
+    if (count < 1) {
+        count = 1;
+    }
+    return (int)min(count, (size_t)rows);
+}
+
+// Writes size bytes of the output file
+static void write_output(fstream& output, const unsigned char* data, size_t size)
+{
+    METRICS_SPAN(STAGE_WRITE);
+    METRICS_COUNT(COUNTER_BYTES_WRITTEN, size);
+    output.write((const char*)data, (streamsize)size);
+}
+
+/**
+ * Reads image rows y0 to y0+count-1 (bottom to top) into buffer, one
+ * stride apart, with their padding bytes cleared.
+ */
+static bool read_rows(BandReader& reader, int y0, int count, unsigned char* buffer)
+{
+    METRICS_SPAN(STAGE_DECODE);
+    const BmpInfo& info = reader.info;
+    size_t stride = reader.stride;
+    METRICS_COUNT(COUNTER_BYTES_READ, stride * count);
+    // Top-down files store the same rows as one run in the opposite order
+    int first = info.top_down ? info.height - y0 - count : y0;
+    reader.stream.seekg((streamoff)(info.start + (uint64_t)stride * first));
+    reader.stream.read((char*)buffer, (streamsize)(stride * count));
+    if (!reader.stream) {
+        return false;
+    }
+    if (info.top_down) {
+        for (int i = 0, j = count - 1; i < j; i++, j--) {
+            swap_ranges(buffer + stride * i, buffer + stride * (i + 1), buffer + stride * j);
+        }
+    }
+    size_t scanline_size = (size_t)info.width * 3;
+    if (scanline_size != stride) {
+        for (int i = 0; i < count; i++) {
+            memset(buffer + stride * i + scanline_size, 0, stride - scanline_size);
+        }
+    }
+    return true;
+}
+
+// Filters (or, for a null kernel, copies) the image band by band
+static bool stream_point_filter(BandReader& reader, fstream& output, RowKernel kernel, const FilterParams& params, size_t band_bytes)
+{
+    const BmpInfo& info = reader.info;
+    int rows = band_rows(reader.stride, info.height, band_bytes);
+    vector<unsigned char> band(reader.stride * rows);
+    for (int y0 = 0; y0 < info.height; y0 += rows) {
+        int count = min(rows, info.height - y0);
+        if (!read_rows(reader, y0, count, band.data())) {
+            return false;
+        }
+        if (kernel != nullptr) {
+            parallel_rows(count, reader.stride, [&](int first, int last) {
+                for (int i = first; i < last; i++) {
+                    unsigned char* row = band.data() + reader.stride * i;
+                    kernel(row, row, info.width, y0 + i, info.height, params);
+                }
+            });
+        }
+        write_output(output, band.data(), reader.stride * count);
+    }
+    return (bool)output;
+}
+
+// Rotates by 180 degrees: each band is mirrored and written to the mirrored output rows
+static bool stream_rotate_180(BandReader& reader, fstream& output, size_t band_bytes)
+{
+    const BmpInfo& info = reader.info;
+    size_t stride = reader.stride;
+    int width = info.width;
+    int rows = band_rows(stride, info.height, band_bytes);
+    vector<unsigned char> band(stride * rows);
+    vector<unsigned char> mirrored(stride * rows, 0);
+    for (int y0 = 0; y0 < info.height; y0 += rows) {
+        int count = min(rows, info.height - y0);
+        if (!read_rows(reader, y0, count, band.data())) {
+            return false;
+        }
+        parallel_rows(count, stride, [&](int first, int last) {
+            for (int i = first; i < last; i++) {
+                const unsigned char* in = band.data() + stride * i;
+                unsigned char* out = mirrored.data() + stride * (count - 1 - i);
+                for (int x = 0; x < width; x++) {
+                    const unsigned char* pixel = in + 3 * (width - 1 - x);
+                    out[3*x]   = pixel[0];
+                    out[3*x+1] = pixel[1];
+                    out[3*x+2] = pixel[2];
+                }
+            }
+        });
+        output.seekp((streamoff)(BMP_FILE_HEADER_SIZE + (uint64_t)stride * (info.height - y0 - count)));
+        write_output(output, mirrored.data(), stride * count);
+    }
+    return (bool)output;
+}
+
+/**
+ * Rotates by 90 (quarter_turns 1) or 270 (quarter_turns 3) degrees clockwise
+ * with a two pass tiled transpose. Pass one transposes each band of input
+ * rows into a block of the scratch file holding, for every output row, the
+ * run of pixels that band contributes. Pass two reads those runs back for a
+ * band of output rows at a time and writes the finished rows in order.
+ */
+static bool stream_rotate_90(BandReader& reader, fstream& output, path scratchFile, int quarter_turns, size_t band_bytes)
+{
+    const BmpInfo& info = reader.info;
+    int width = info.width;
+    int height = info.height;
+    const int TILE = 32;
+
+    fstream scratch;
+    scratch.open(scratchFile, ios::in | ios::out | ios::trunc | ios::binary);
+    if (!scratch.is_open()) {
+        return false;
+    }
+
+    // Pass one: band of input rows -> transposed block in the scratch file
+    int rows = band_rows(reader.stride, height, band_bytes);
+    vector<unsigned char> band(reader.stride * rows);
+    vector<unsigned char> block((size_t)width * rows * 3);
+    vector<int> band_start;
+    for (int y0 = 0; y0 < height; y0 += rows) {
+        int count = min(rows, height - y0);
+        if (!read_rows(reader, y0, count, band.data())) {
+            return false;
+        }
+        size_t run = (size_t)count * 3;
+        // Columns of the band become runs of distinct output rows, so split the work by column
+        int column_tiles = (width + TILE - 1) / TILE;
+        parallel_rows(column_tiles, run * TILE, [&](int first, int last) {
+            for (int i0 = 0; i0 < count; i0 += TILE) {
+                for (int x0 = first * TILE; x0 < min(last * TILE, width); x0 += TILE) {
+                    for (int i = i0; i < min(i0 + TILE, count); i++) {
+                        const unsigned char* in = band.data() + reader.stride * i;
+                        for (int x = x0; x < min(x0 + TILE, width); x++) {
+                            // Output row and position of input pixel (x, y0 + i) within this band's run
+                            unsigned char* out = (quarter_turns == 1)
+                                ? block.data() + run * (width - 1 - x) + 3 * i
+                                : block.data() + run * x + 3 * (count - 1 - i);
+                            out[0] = in[3*x];
+                            out[1] = in[3*x+1];
+                            out[2] = in[3*x+2];
+                        }
+                    }
+                }
+            }
+        });
+        scratch.write((const char*)block.data(), (streamsize)(run * width));
+        band_start.push_back(y0);
+    }
+    if (!scratch) {
+        return false;
+    }
+
+    // Pass two: runs of every block -> finished output rows
+    int new_width = height;
+    int new_height = width;
+    size_t new_stride = bmp_encoded_size(new_width, 1) - BMP_FILE_HEADER_SIZE;
+    int out_rows = band_rows(new_stride, new_height, band_bytes);
+    vector<unsigned char> out_band(new_stride * out_rows, 0);
+    vector<unsigned char> runs;
+    for (int r0 = 0; r0 < new_height; r0 += out_rows) {
+        int out_count = min(out_rows, new_height - r0);
+        uint64_t block_offset = 0;
+        for (size_t k = 0; k < band_start.size(); k++) {
+            int y0 = band_start[k];
+            int count = min(rows, height - y0);
+            size_t run = (size_t)count * 3;
+            runs.resize(run * out_count);
+            scratch.seekg((streamoff)(block_offset + (uint64_t)run * r0));
+            scratch.read((char*)runs.data(), (streamsize)runs.size());
+            int x_offset = (quarter_turns == 1) ? y0 : height - y0 - count;
+            for (int r = 0; r < out_count; r++) {
+                memcpy(out_band.data() + new_stride * r + 3 * (size_t)x_offset, runs.data() + run * r, run);
+            }
+            block_offset += (uint64_t)run * width;
+        }
+        if (!scratch) {
+            return false;
+        }
+        write_output(output, out_band.data(), new_stride * out_count);
+    }
+    return (bool)output;
+}
+
+/**
+ * Scales the image (see scale_rows) reading the input a band at a time and
+ * writing each output row as soon as it is finished, so neither the input
+ * nor the output image is ever held whole.
+ */
+static bool stream_scale(BandReader& reader, fstream& output, double x_scale, double y_scale, size_t band_bytes)
+{
+    const BmpInfo& info = reader.info;
+    int rows = band_rows(reader.stride, info.height, band_bytes);
+    vector<unsigned char> band(reader.stride * rows);
+    int band_first = 0;
+    int band_count = 0;
+    bool read = true;
+    size_t new_stride = bmp_encoded_size(scaled_size(info.width, x_scale), 1) - BMP_FILE_HEADER_SIZE;
+    bool scaled = scale_rows(info.width, info.height,
+        [&](int y) {
+            if (y >= band_first + band_count) {
+                band_first = y;
+                band_count = min(rows, info.height - y);
+                read = read && read_rows(reader, band_first, band_count, band.data());
+            }
+            return band.data() + reader.stride * (y - band_first);
+        },
+        x_scale, y_scale,
+        [&](const unsigned char* row) {
+            write_output(output, row, new_stride);
+            return read && (bool)output;
+        });
+    return scaled && read && (bool)output;
+}
+
+// Returns true if process_streaming can run the processor
+bool supports_streaming(int userChoice)
+{
+    return point_kernel(userChoice) != nullptr || (userChoice >= 4 && userChoice <= 6);
+}
+
+/**
+ * Runs a processor over a BMP file band by band without loading the image.
+ * @param inputFile  The 24-bit BMP file to process
+ * @param outputFile The BMP file to write
+ * @param userChoice The processor to run (see supports_streaming)
+ * @param params     Parameters of the processor
+ * @param band_bytes Upper bound on the scanline data held in memory
+ * @return True if the output was written and false otherwise
+ */
+bool process_streaming(path inputFile, path outputFile, int userChoice, const FilterParams& params, size_t band_bytes)
+{
+    if (!supports_streaming(userChoice)) {
+        return false;
+    }
+    if (userChoice == 6 && !(params.x_scale > 0 && params.y_scale > 0)) {
+        return false;
+    }
+    METRICS_SPAN(STAGE_PROCESS);
+    BandReader reader;
+    reader.stream.open(inputFile, ios::in | ios::binary);
+    unsigned char header[BMP_FILE_HEADER_SIZE];
+    reader.stream.read((char*)header, sizeof(header));
+    if (!reader.stream || !parse_bmp_header(header, reader.info)) {
+        return false;
+    }
+    if (userChoice == 6 && !scale_fits(reader.info.width, reader.info.height, params.x_scale, params.y_scale)) {
+        return false;
+    }
+    reader.stride = bmp_encoded_size(reader.info.width, 1) - BMP_FILE_HEADER_SIZE;
+    METRICS_COUNT(COUNTER_PIXELS, (uint64_t)reader.info.width * reader.info.height);
+
+    // process_5 turns the image number times; four turns are the identity
+    int quarter_turns = 0;
+    if (userChoice == 4) {
+        quarter_turns = 1;
+    }
+    else if (userChoice == 5 && params.rotations > 0) {
+        quarter_turns = params.rotations % 4;
+    }
+    bool transposed = quarter_turns % 2 == 1;
+
+    // A new file, also when outputFile is the input the reader still holds open
+    remove_output(outputFile);
+    fstream output;
+    output.open(outputFile, ios::out | ios::trunc | ios::binary);
+    if (!output.is_open()) {
+        return false;
+    }
+    if (userChoice == 6) {
+        encode_bmp_header(header, scaled_size(reader.info.width, params.x_scale), scaled_size(reader.info.height, params.y_scale));
+    }
+    else if (transposed) {
+        encode_bmp_header(header, reader.info.height, reader.info.width);
+    }
+    else {
+        encode_bmp_header(header, reader.info.width, reader.info.height);
+    }
+    write_output(output, header, sizeof(header));
+
+    if (userChoice == 6) {
+        return stream_scale(reader, output, params.x_scale, params.y_scale, band_bytes);
+    }
+    if (userChoice != 4 && userChoice != 5) {
+        return stream_point_filter(reader, output, point_kernel(userChoice), params, band_bytes);
+    }
+    if (quarter_turns == 0) {
+        return stream_point_filter(reader, output, nullptr, params, band_bytes);
+    }
+    if (quarter_turns == 2) {
+        return stream_rotate_180(reader, output, band_bytes);
+    }
+    path scratchFile = outputFile;
+    scratchFile += ".scratch";
+    bool written = stream_rotate_90(reader, output, scratchFile, quarter_turns, band_bytes);
+    error_code ec;
+    remove(scratchFile, ec);
+    return written;
+}
@@ -0,0 +1,30 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include "image.h"
+
+// Default amount of scanline data held in memory at once by the streaming engine
+const size_t DEFAULT_BAND_BYTES = (size_t)64 << 20;
+
+// Images whose pixel array is larger than this are processed by the streaming engine
+const uint64_t STREAMING_THRESHOLD_BYTES = (uint64_t)1 << 30;
+
+// Returns true if process_streaming can run the processor
+bool supports_streaming(int userChoice);
+
+/**
+ * Runs a processor over a BMP file band by band without loading the image.
+ * Point filters read a band of scanlines, filter it and write it out before
+ * reading the next. Rotations transpose each band into a scratch file next to
+ * the output and assemble the output rows from it in a second pass. Scaling
+ * writes each output row as soon as the input rows under it have been read.
+ * @param inputFile  The 24-bit BMP file to process
+ * @param outputFile The BMP file to write
+ * @param userChoice The processor to run (see supports_streaming)
+ * @param params     Parameters of the processor
+ * @param band_bytes Upper bound on the scanline data held in memory
+ * @return True if the output was written and false otherwise
+ */
+bool process_streaming(path inputFile, path outputFile, int userChoice, const FilterParams& params, size_t band_bytes = DEFAULT_BAND_BYTES);
+
+#endif
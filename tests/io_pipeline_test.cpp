@@ -0,0 +1,139 @@
+// Checks that the read/filter/write pipeline (--prefetch) writes the same
+// files as the plain batch run, for plain and histogram driven processors,
+// and fails a truncated file, and a paletted file whose header claims far
+// more pixels than it holds, without losing the others. Built with
+// IMAGE_IO_URING (make test-uring) this runs the io_uring reader; built
+// with IMAGE_METRICS (tests/io_pipeline_metrics_test) it also checks that
+// the pipeline logs one metrics line per file.
+#include "io_pipeline.h"
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+// Reads a whole file, or returns an empty string if it cannot
+static string file_bytes(const path& file)
+{
+    ifstream in(file, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+// Writes a noisy gradient of the given size, so every row has its own values
+static bool write_test_image(const path& file, int width, int height, mt19937& random)
+{
+    Image image(width, height);
+    for (int y = 0; y < height; y++) {
+        unsigned char* row = image.row(y);
+        for (int x = 0; x < width * 3; x++) {
+            row[x] = (unsigned char)((x * 7 + y * 3) / 4 + random() % 32);
+        }
+    }
+    return write_image(file.string(), image);
+}
+
+// Returns how many files lack exactly one metrics line in log, or have one without the bytes and pixels they moved
+static int check_metrics(const char* spec, const string& log, const vector<path>& files)
+{
+    int failures = 0;
+    for (const path& file : files) {
+        bool ok = file.stem() != "truncated" && file.stem() != "forged";
+        string name = "\"file\": \"" + file.string() + "\", \"ok\": " + (ok ? "true" : "false");
+        int lines = 0;
+        bool counted = true;
+        istringstream in(log);
+        string line;
+        while (getline(in, line)) {
+            if (line.find(name) == string::npos) {
+                continue;
+            }
+            lines++;
+            for (const char* counter : { "\"bytes_read\": 0,", "\"bytes_written\": 0,", "\"pixels\": 0," }) {
+                counted = counted && (!ok || line.find(counter) == string::npos);
+            }
+        }
+        if (lines != 1 || !counted) {
+            std::cerr << spec << ": " << lines << " metrics lines for " << file.string() << (counted ? "" : ", missing counts") << endl;
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main()
+{
+    path dir = temp_directory_path() / ("io_pipeline_test_" + to_string(getpid()));
+    create_directories(dir / "in");
+    mt19937 random(12345);
+    // Odd widths leave padding at the end of each row
+    int sizes[][2] = { { 64, 48 }, { 333, 101 }, { 1, 1 }, { 1024, 300 }, { 17, 900 } };
+    int written = 0;
+    for (auto& size : sizes) {
+        path file = dir / "in" / ("image" + to_string(written++) + ".bmp");
+        if (!write_test_image(file, size[0], size[1], random)) {
+            std::cerr << "Could not write " << file.string() << endl;
+            return 1;
+        }
+    }
+    // Cut off in the middle of the pixel array
+    string whole = file_bytes(dir / "in" / "image1.bmp");
+    ofstream(dir / "in" / "truncated.bmp", ios::binary) << whole.substr(0, whole.size() / 2);
+    // A 1-bit header of 2000000000 x 2000000000 with a two colour palette and no pixels
+    unsigned char forged[62] = { 'B', 'M' };
+    set_bytes(forged, 2, 4, (int)sizeof(forged));
+    set_bytes(forged, 10, 4, (int)sizeof(forged));
+    set_bytes(forged, 14, 4, 40);
+    set_bytes(forged, 18, 4, 2000000000);
+    set_bytes(forged, 22, 4, 2000000000);
+    set_bytes(forged, 26, 2, 1);
+    set_bytes(forged, 28, 2, 1);
+    set_bytes(forged, 46, 4, 2);
+    ofstream(dir / "in" / "forged.bmp", ios::binary).write((const char*)forged, sizeof(forged));
+
+    vector<path> files = collect_inputs({ (dir / "in").string() });
+    const char* specs[] = { "3", "9:0.4,1", "7:auto", "10:auto", "20", "4,20", "8:0.3,20:1" };
+    int failures = 0;
+    for (const char* spec : specs) {
+        BatchOptions options;
+        if (!parse_operations(spec, options.operations)) {
+            std::cerr << "Could not parse " << spec << endl;
+            return 1;
+        }
+        options.processName = process_name(options.operations);
+        options.threads = 2;
+        options.outputDir = dir / "batch";
+        create_directories(options.outputDir);
+        BatchSummary batch = run_batch(files, options);
+        options.outputDir = dir / "pipeline";
+        create_directories(options.outputDir);
+        options.prefetch = 2;
+#ifdef IMAGE_METRICS
+        stringstream log;
+        streambuf* saved = std::cerr.rdbuf(log.rdbuf());
+#endif
+        BatchSummary pipeline = run_io_pipeline(files, options);
+#ifdef IMAGE_METRICS
+        std::cerr.rdbuf(saved);
+        failures += check_metrics(spec, log.str(), files);
+#endif
+        if (pipeline.processed != batch.processed || pipeline.failed != 2 || batch.failed != 2) {
+            std::cerr << spec << ": the pipeline processed " << pipeline.processed << " and failed " << pipeline.failed
+                      << ", the batch processed " << batch.processed << " and failed " << batch.failed << endl;
+            failures++;
+        }
+        for (const path& file : files) {
+            options.outputDir = dir / "batch";
+            path expected = batch_output_path(file, options);
+            options.outputDir = dir / "pipeline";
+            path actual = batch_output_path(file, options);
+            if (file_bytes(expected) != file_bytes(actual)) {
+                std::cerr << spec << ": " << actual.string() << " differs from " << expected.string() << endl;
+                failures++;
+            }
+        }
+        remove_all(dir / "batch");
+        remove_all(dir / "pipeline");
+    }
+    remove_all(dir);
+    std::cout << sizeof(specs) / sizeof(specs[0]) << " filters checked, " << failures << " mismatches" << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+// Checks that with --cache-link, where an output is a hard link to its
+// cache entry, a later run that writes a different result to the same
+// output leaves the cached result alone. Each output writer an uncached
+// run may use gets its turn: the output is linked to the cached darken 0.5
+// result, the writer puts a darken 0.2 result (or another image) there,
+// and the cache must still serve darken 0.5.
+#include "result_cache.h"
+#include "mapped_io.h"
+#include "streaming.h"
+#include "indexed_bmp.h"
+#include "view.h"
+#include <fstream>
+#include <functional>
+#include <random>
+#include <unistd.h>
+
+// Reads a whole file, or returns an empty string if it cannot
+static string file_bytes(const path& file)
+{
+    ifstream in(file, ios::binary);
+    return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+}
+
+int main()
+{
+    path dir = temp_directory_path() / ("result_cache_test_" + to_string(getpid()));
+    create_directories(dir);
+    path input = dir / "input.bmp";
+    path output = dir / "output.bmp";
+    path fetched = dir / "fetched.bmp";
+
+    // Odd width, so rows are padded
+    Image image(333, 101);
+    mt19937 random(12345);
+    for (int y = 0; y < image.height; y++) {
+        for (int x = 0; x < image.width * 3; x++) {
+            image.row(y)[x] = (unsigned char)random();
+        }
+    }
+    if (!write_image(input.string(), image) || !open_result_cache(dir / "cache", DEFAULT_CACHE_LIMIT, true)) {
+        std::cerr << "Could not set up in " << dir.string() << endl;
+        return 1;
+    }
+    vector<Operation> operations;
+    parse_operations("9:0.5", operations);
+    string key = result_key(image, operations);
+    write_image(output.string(), process_9(image, 0.5));
+    store_result(key, output);
+    string expected = file_bytes(output);
+
+    FilterParams params;
+    params.scaling_factor = 0.2;
+    Image darker = process_9(image, 0.2);
+    ImageView turned = make_view(darker);
+    FilterParams half_turn;
+    half_turn.rotations = 2;
+    apply_view_op(turned, 5, half_turn);
+
+    vector<pair<string, function<bool()>>> writers = {
+        { "write_image", [&] { return write_image(output.string(), darker); } },
+        { "write_view", [&] { return write_view(output.string(), turned); } },
+        { "write_indexed_image", [&] { return write_indexed_image(output.string(), process_7(image, 127), vector<uint32_t>(), false); } },
+        { "process_mapped", [&] { return process_mapped(input, output, 9, params); } },
+        { "process_mapped in place", [&] { return process_mapped(output, output, 9, params); } },
+        { "process_streaming", [&] { return process_streaming(input, output, 9, params, 4096); } },
+    };
+    int failures = 0;
+    for (auto& writer : writers) {
+        if (!fetch_result(key, output) || hard_link_count(output) < 2) {
+            std::cerr << writer.first << ": the output is not linked to the cache entry" << endl;
+            failures++;
+            continue;
+        }
+        if (!writer.second()) {
+            std::cerr << writer.first << ": could not write " << output.string() << endl;
+            failures++;
+            continue;
+        }
+        if (file_bytes(output) == expected) {
+            std::cerr << writer.first << ": wrote the cached result again" << endl;
+            failures++;
+        }
+        if (!fetch_result(key, fetched) || file_bytes(fetched) != expected) {
+            std::cerr << writer.first << ": changed the cached result" << endl;
+            failures++;
+        }
+    }
+    remove_all(dir);
+    std::cout << writers.size() << " writers checked, " << failures << " failures" << endl;
+    return failures == 0 ? 0 : 1;
+}
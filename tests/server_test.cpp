@@ -0,0 +1,64 @@
+// Checks that a client sending a few thousand jobs at once, with long
+// paths, gets every response: more requests and responses than the socket
+// buffers hold are in flight at the same time, so a client or server that
+// does not read while it writes stalls. An alarm fails the test if it does.
+#include "server.h"
+#include <cstdio>
+#include <thread>
+#include <unistd.h>
+
+// Runs server_main with the given arguments
+static int run_main(vector<string> arguments)
+{
+    arguments.insert(arguments.begin(), "main");
+    vector<char*> argv;
+    for (string& argument : arguments) {
+        argv.push_back(&argument[0]);
+    }
+    return server_main((int)argv.size(), argv.data());
+}
+
+int main()
+{
+    const int FILES = 3000;
+    // Seconds before a stalled exchange fails the test
+    alarm(300);
+    // Long directory names make each request a few hundred bytes
+    path dir = temp_directory_path() / ("server_test_" + to_string(getpid()));
+    path input = dir / string(200, 'i');
+    path output = dir / string(200, 'o');
+    create_directories(input);
+    create_directories(output);
+    Image image(2, 2);
+    if (!write_image((input / "0.bmp").string(), image)) {
+        std::cerr << "Could not write " << (input / "0.bmp").string() << endl;
+        return 1;
+    }
+    for (int i = 1; i < FILES; i++) {
+        copy_file(input / "0.bmp", input / (to_string(i) + ".bmp"));
+    }
+
+    // What the server and client print, from their own threads, stays out of the test output
+    if (freopen("/dev/null", "w", stdout) == nullptr) {
+        return 1;
+    }
+    string socket = (dir / "s.sock").string();
+    thread server([&] { run_main({ "--serve", socket, "--threads", "2" }); });
+    // Wait for the server to listen
+    int status = 1;
+    for (int tries = 0; tries < 100 && status != 0; tries++) {
+        this_thread::sleep_for(chrono::milliseconds(50));
+        status = exists(socket) ? 0 : 1;
+    }
+    int jobs = run_main({ "--client", socket, "--filter", "3", "--output-dir", output.string(), input.string() });
+    int stopped = run_main({ "--client", socket, "--shutdown" });
+    server.join();
+
+    int written = 0;
+    for (const directory_entry& entry : directory_iterator(output)) {
+        written += entry.path().extension() == ".bmp" ? 1 : 0;
+    }
+    remove_all(dir);
+    std::cerr << FILES << " jobs sent, " << written << " outputs written" << endl;
+    return status == 0 && jobs == 0 && stopped == 0 && written == FILES ? 0 : 1;
+}
@@ -0,0 +1,107 @@
+#include "threadpool.h"
+
+// Index of the pool worker running on this thread, -1 elsewhere
+static thread_local int worker_index = -1;
+static thread_local const ThreadPool* worker_pool = nullptr;
+
+ThreadPool::ThreadPool(int threads) : queued_(0), pending_(0), stopping_(false), next_(0)
+{
+    if (threads < 1) {
+        threads = (int)thread::hardware_concurrency();
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    for (int i = 0; i < threads; i++) {
+        workers_.push_back(unique_ptr<Worker>(new Worker()));
+    }
+    for (int i = 0; i < threads; i++) {
+        threads_.push_back(thread(&ThreadPool::run, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(lock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < threads_.size(); i++) {
+        threads_[i].join();
+    }
+}
+
+void ThreadPool::submit(function<void()> task)
+{
+    {
+        lock_guard<mutex> guard(lock_);
+        queued_++;
+        pending_++;
+    }
+    int index = (worker_pool == this) ? worker_index : (int)(next_++ % workers_.size());
+    {
+        lock_guard<mutex> guard(workers_[index]->lock);
+        workers_[index]->tasks.push_back(move(task));
+    }
+    wake_.notify_one();
+}
+
+void ThreadPool::wait()
+{
+    unique_lock<mutex> guard(lock_);
+    idle_.wait(guard, [this] { return pending_ == 0; });
+}
+
+// Takes the newest task of worker index, or else steals the oldest task of another worker
+bool ThreadPool::take_task(int index, function<void()>& task)
+{
+    size_t count = workers_.size();
+    for (size_t i = 0; i < count; i++) {
+        Worker& worker = *workers_[(index + i) % count];
+        lock_guard<mutex> guard(worker.lock);
+        if (worker.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+        else {
+            task = move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::run(int index)
+{
+    worker_index = index;
+    worker_pool = this;
+    for (;;) {
+        function<void()> task;
+        if (take_task(index, task)) {
+            {
+                lock_guard<mutex> guard(lock_);
+                queued_--;
+            }
+            task();
+            lock_guard<mutex> guard(lock_);
+            if (--pending_ == 0) {
+                idle_.notify_all();
+            }
+            continue;
+        }
+        unique_lock<mutex> guard(lock_);
+        // A submitted task may still be on its way into a deque; look again
+        if (queued_ > 0) {
+            continue;
+        }
+        if (stopping_) {
+            return;
+        }
+        wake_.wait(guard, [this] { return stopping_ || queued_ > 0; });
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/**
+ * Work-stealing thread pool.
+ * Every worker owns a task deque. Tasks submitted from a worker go on its own
+ * deque and are taken newest first; tasks submitted from outside are spread
+ * round robin. A worker whose deque is empty steals the oldest task of
+ * another worker before going to sleep.
+ */
+class ThreadPool {
+public:
+	// Starts the given number of workers, or one per hardware thread if threads < 1
+	explicit ThreadPool(int threads = 0);
+
+	// Finishes the queued tasks and joins the workers
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void submit(function<void()> task);
+
+	// Blocks until every submitted task has finished; must not be called from a task
+	void wait();
+
+	int size() const { return (int)threads_.size(); }
+
+private:
+	struct Worker {
+		mutex lock;
+		deque<function<void()> > tasks;
+	};
+
+	void run(int index);
+	bool take_task(int index, function<void()>& task);
+
+	vector<unique_ptr<Worker> > workers_;
+	vector<thread> threads_;
+	mutex lock_;
+	condition_variable wake_;
+	condition_variable idle_;
+	size_t queued_;
+	size_t pending_;
+	bool stopping_;
+	atomic<unsigned> next_;
+};
+
+#endif
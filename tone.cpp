@@ -0,0 +1,280 @@
+#include "tone.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+// Multiplies and adds are never fused, whatever the build flags, so these give the bytes of the vector kernels
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// Rounds and clamps a curve value to a channel value
+static unsigned char curve_value(double value)
+{
+    return clamp_byte((int)floor(value + 0.5));
+}
+
+// Curve that leaves every value unchanged
+ToneCurve identity_curve()
+{
+    ToneCurve curve;
+    for (int v = 0; v < 256; v++) {
+        curve.table[v] = (unsigned char)v;
+    }
+    return curve;
+}
+
+// Curve of process_8: 255 - (255 - v) * scaling_factor
+ToneCurve lighten_curve(double scaling_factor)
+{
+    // Same expression and truncation as the lighten kernel, so results match it exactly
+    ToneCurve curve;
+    uint32_t factor = fixed_factor(scaling_factor);
+    for (int v = 0; v < 256; v++) {
+        curve.table[v] = fixed_point() ? fixed_lighten(v, factor) : clamp_byte(int(255 - (255 - v) * scaling_factor));
+    }
+    return curve;
+}
+
+// Curve of process_9: v * scaling_factor
+ToneCurve darken_curve(double scaling_factor)
+{
+    ToneCurve curve;
+    uint32_t factor = fixed_factor(scaling_factor);
+    for (int v = 0; v < 256; v++) {
+        curve.table[v] = fixed_point() ? fixed_darken(v, factor) : clamp_byte(int(v * scaling_factor));
+    }
+    return curve;
+}
+
+// Gamma correction: 255 * (v / 255) ^ (1 / gamma), so gamma above 1 brightens
+ToneCurve gamma_curve(double gamma)
+{
+    if (gamma <= 0) {
+        return identity_curve();
+    }
+    ToneCurve curve;
+    for (int v = 0; v < 256; v++) {
+        curve.table[v] = curve_value(255 * pow(v / 255.0, 1 / gamma));
+    }
+    return curve;
+}
+
+// Levels: stretches black_point..white_point to 0..255, clipping outside it
+ToneCurve levels_curve(int black_point, int white_point)
+{
+    if (white_point <= black_point) {
+        return identity_curve();
+    }
+    ToneCurve curve;
+    for (int v = 0; v < 256; v++) {
+        curve.table[v] = curve_value((v - black_point) * 255.0 / (white_point - black_point));
+    }
+    return curve;
+}
+
+// Contrast: scales the distance from mid-gray by amount
+ToneCurve contrast_curve(double amount)
+{
+    ToneCurve curve;
+    for (int v = 0; v < 256; v++) {
+        curve.table[v] = curve_value((v - 127.5) * amount + 127.5);
+    }
+    return curve;
+}
+
+// Curve applying first and then then
+ToneCurve compose_curves(const ToneCurve& first, const ToneCurve& then)
+{
+    ToneCurve curve;
+    for (int v = 0; v < 256; v++) {
+        curve.table[v] = then.table[first.table[v]];
+    }
+    return curve;
+}
+
+// Returns true if the processor is a tone curve (a per-channel mapping of values)
+bool is_tone_filter(int userChoice)
+{
+    return userChoice == 8 || userChoice == 9 || (userChoice >= 11 && userChoice <= 13);
+}
+
+// Identifies a curve: the filter and the parameters it depends on, and for lighten and darken the arithmetic
+typedef tuple<int, double, double> CurveKey;
+
+static CurveKey curve_key(int userChoice, const FilterParams& params)
+{
+    switch (userChoice) {
+    case 11: return CurveKey(userChoice, params.gamma, 0);
+    case 12: return CurveKey(userChoice, params.black_point, params.white_point);
+    case 13: return CurveKey(userChoice, params.contrast, 0);
+    default: return CurveKey(userChoice, params.scaling_factor, fixed_point() ? 1 : 0);
+    }
+}
+
+static ToneCurve build_curve(int userChoice, const FilterParams& params)
+{
+    switch (userChoice) {
+    case 8:  return lighten_curve(params.scaling_factor);
+    case 9:  return darken_curve(params.scaling_factor);
+    case 11: return gamma_curve(params.gamma);
+    case 12: return levels_curve(params.black_point, params.white_point);
+    case 13: return contrast_curve(params.contrast);
+    default: return identity_curve();
+    }
+}
+
+// Curves kept in the shared cache; a server sees a new set of parameters with almost every request
+const size_t CURVE_CACHE_SIZE = 64;
+
+struct CachedCurve {
+    CurveKey key;
+    ToneCurve curve;
+};
+
+/**
+ * Returns the curve of a tone filter with the given parameters.
+ * Kernels ask for their curve on every row, so each thread remembers the
+ * last few curves it was given and only goes to the shared cache on a miss.
+ * The shared cache keeps the most recently used curves; a curve it drops
+ * stays alive while a thread still remembers it, so the reference handed
+ * out is valid until the thread has asked for RECENT other curves.
+ * @param userChoice The tone filter
+ * @param params     Parameters of the filter
+ * @return The cached curve
+ */
+const ToneCurve& tone_curve(int userChoice, const FilterParams& params)
+{
+    static mutex cache_lock;
+    static list<shared_ptr<const CachedCurve>> cache;
+    // A few entries, since claredon alternates between two curves
+    const int RECENT = 4;
+    thread_local shared_ptr<const CachedCurve> recent[RECENT];
+    thread_local int next_recent = 0;
+
+    CurveKey key = curve_key(userChoice, params);
+    for (int i = 0; i < RECENT; i++) {
+        if (recent[i] && recent[i]->key == key) {
+            return recent[i]->curve;
+        }
+    }
+    shared_ptr<const CachedCurve> found;
+    {
+        lock_guard<mutex> guard(cache_lock);
+        for (list<shared_ptr<const CachedCurve>>::iterator it = cache.begin(); it != cache.end(); ++it) {
+            if ((*it)->key == key) {
+                cache.splice(cache.begin(), cache, it);
+                found = cache.front();
+                break;
+            }
+        }
+        if (!found) {
+            found = make_shared<const CachedCurve>(CachedCurve{ key, build_curve(userChoice, params) });
+            cache.push_front(found);
+            if (cache.size() > CURVE_CACHE_SIZE) {
+                cache.pop_back();
+            }
+        }
+    }
+    recent[next_recent] = found;
+    next_recent = (next_recent + 1) % RECENT;
+    return found->curve;
+}
+
+// Maps width BGR pixels of in through the curve into out, which may be in
+void apply_curve_row(const ToneCurve& curve, const unsigned char* in, unsigned char* out, int width)
+{
+    const unsigned char* table = curve.table;
+    int count = width * 3;
+    int i = 0;
+    // Four independent lookups per step keep several loads in flight
+    for (; i + 4 <= count; i += 4) {
+        unsigned char a = table[in[i]];
+        unsigned char b = table[in[i+1]];
+        unsigned char c = table[in[i+2]];
+        unsigned char d = table[in[i+3]];
+        out[i]   = a;
+        out[i+1] = b;
+        out[i+2] = c;
+        out[i+3] = d;
+    }
+    for (; i < count; i++) {
+        out[i] = table[in[i]];
+    }
+}
+
+// Kernel of every tone filter: one lookup per channel
+static void curve_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params, int userChoice)
+{
+    apply_curve_row(tone_curve(userChoice, params), in, out, width);
+}
+
+static void lighten_curve_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    curve_row(in, out, width, y, height, params, 8);
+}
+
+static void darken_curve_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    curve_row(in, out, width, y, height, params, 9);
+}
+
+static void gamma_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    curve_row(in, out, width, y, height, params, 11);
+}
+
+static void levels_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    curve_row(in, out, width, y, height, params, 12);
+}
+
+static void contrast_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    curve_row(in, out, width, y, height, params, 13);
+}
+
+// Claredon: the lighten curve for light pixels, the darken curve for dark ones
+static void claredon_curve_row(const unsigned char* in, unsigned char* out, int width, int y, int height, const FilterParams& params)
+{
+    const unsigned char* light = tone_curve(8, params).table;
+    const unsigned char* dark = tone_curve(9, params).table;
+    for (int x = 0; x < width; x++) {
+        int b = in[3*x];
+        int g = in[3*x+1];
+        int r = in[3*x+2];
+        int average = average_of_three(b + g + r);
+        if (average > 170) {
+            out[3*x]   = light[b];
+            out[3*x+1] = light[g];
+            out[3*x+2] = light[r];
+        }
+        else if (average < 90) {
+            out[3*x]   = dark[b];
+            out[3*x+1] = dark[g];
+            out[3*x+2] = dark[r];
+        }
+        else {
+            out[3*x]   = b;
+            out[3*x+1] = g;
+            out[3*x+2] = r;
+        }
+    }
+}
+
+// Returns the table driven kernel of a tone filter or of claredon, or nullptr for other processors
+RowKernel tone_kernel(int userChoice)
+{
+    switch (userChoice) {
+    case 2:  return claredon_curve_row;
+    case 8:  return lighten_curve_row;
+    case 9:  return darken_curve_row;
+    case 11: return gamma_row;
+    case 12: return levels_row;
+    case 13: return contrast_row;
+    }
+    return nullptr;
+}
@@ -0,0 +1,48 @@
+#ifndef TONE_H
+#define TONE_H
+
+#include "kernels.h"
+
+// Maps every channel value 0-255 to its new value
+struct ToneCurve {
+	unsigned char table[256];
+};
+
+// Curve that leaves every value unchanged
+ToneCurve identity_curve();
+
+// Curve of process_8: 255 - (255 - v) * scaling_factor, in fixed point if set_fixed_point is on
+ToneCurve lighten_curve(double scaling_factor);
+
+// Curve of process_9: v * scaling_factor, in fixed point if set_fixed_point is on
+ToneCurve darken_curve(double scaling_factor);
+
+// Gamma correction: 255 * (v / 255) ^ (1 / gamma), so gamma above 1 brightens
+ToneCurve gamma_curve(double gamma);
+
+// Levels: stretches black_point..white_point to 0..255, clipping outside it
+ToneCurve levels_curve(int black_point, int white_point);
+
+// Contrast: scales the distance from mid-gray by amount
+ToneCurve contrast_curve(double amount);
+
+// Curve applying first and then then
+ToneCurve compose_curves(const ToneCurve& first, const ToneCurve& then);
+
+// Returns true if the processor is a tone curve (a per-channel mapping of values)
+bool is_tone_filter(int userChoice);
+
+/**
+ * Returns the curve of a tone filter with the given parameters. The most
+ * recently used curves are kept; the reference stays valid until the calling
+ * thread has asked for a few other curves.
+ */
+const ToneCurve& tone_curve(int userChoice, const FilterParams& params);
+
+// Maps width BGR pixels of in through the curve into out, which may be in
+void apply_curve_row(const ToneCurve& curve, const unsigned char* in, unsigned char* out, int width);
+
+// Returns the table driven kernel of a tone filter or of claredon, or nullptr for other processors
+RowKernel tone_kernel(int userChoice);
+
+#endif
@@ -0,0 +1,214 @@
+#include "view.h"
+#include "parallel.h"
+#include "resample.h"
+#include "metrics.h"
+#include <cstring>
+
+// Side of the square tiles a rotated view is read in
+const int TILE = 32;
+
+// Scanline data written per band by write_view
+const size_t WRITE_BAND_BYTES = (size_t)4 << 20;
+
+// Returns a view showing the image as it is
+ImageView make_view(const Image& image)
+{
+    return ImageView{ &image, image.width, image.height, 0, 0, 1, 0, 0, 1, 1, 1 };
+}
+
+// Returns true if the view shows its source as it is
+bool is_identity(const ImageView& view)
+{
+    return view.origin_x == 0 && view.origin_y == 0 && view.xx == 1 && view.xy == 0
+        && view.yx == 0 && view.yy == 1 && view.x_scale == 1 && view.y_scale == 1;
+}
+
+// Returns true if the processor only moves pixels and can be added to a view (rotations, flips and whole scale enlarges)
+bool is_view_op(int userChoice, const FilterParams& params)
+{
+    switch (userChoice) {
+    case 4:
+    case 5:
+    case 14:
+    case 15:
+        return true;
+    case 6:
+        return is_whole_scale(params.x_scale) && is_whole_scale(params.y_scale);
+    }
+    return false;
+}
+
+/**
+ * Follows the view with an orientation that shows pixel
+ * (a + b11*p + b12*q, c + b21*p + b22*q) of the oriented image at (p, q).
+ * The orientation goes before the enlarge, swapping its scales if it swaps
+ * the axes.
+ */
+static void orient(ImageView& view, int a, int b11, int b12, int c, int b21, int b22)
+{
+    ImageView old = view;
+    view.origin_x = old.origin_x + old.xx * a + old.xy * c;
+    view.origin_y = old.origin_y + old.yx * a + old.yy * c;
+    view.xx = old.xx * b11 + old.xy * b21;
+    view.xy = old.xx * b12 + old.xy * b22;
+    view.yx = old.yx * b11 + old.yy * b21;
+    view.yy = old.yx * b12 + old.yy * b22;
+    if (b11 == 0) {
+        swap(view.width, view.height);
+        swap(view.x_scale, view.y_scale);
+    }
+}
+
+// Turns the view by quarter_turns times 90 degrees clockwise, taken modulo 4
+static void rotate_view(ImageView& view, int quarter_turns)
+{
+    int w = view.width;
+    int h = view.height;
+    switch (((quarter_turns % 4) + 4) % 4) {
+    case 1: orient(view, w - 1, 0, -1, 0, 1, 0); break;
+    case 2: orient(view, w - 1, -1, 0, h - 1, 0, -1); break;
+    case 3: orient(view, 0, 0, 1, h - 1, -1, 0); break;
+    }
+}
+
+/**
+ * Adds the processor to the view.
+ * @param view       The view to change
+ * @param userChoice A processor for which is_view_op is true
+ * @param params     Parameters of the processor
+ */
+void apply_view_op(ImageView& view, int userChoice, const FilterParams& params)
+{
+    switch (userChoice) {
+    case 4:
+        rotate_view(view, 1);
+        break;
+    case 5:
+        // process_5 turns nothing for a negative count
+        rotate_view(view, params.rotations > 0 ? params.rotations : 0);
+        break;
+    case 14:
+        orient(view, view.width - 1, -1, 0, 0, 0, 1);
+        break;
+    case 15:
+        orient(view, 0, 1, 0, view.height - 1, 0, -1);
+        break;
+    case 6:
+        // Saturates rather than wraps, so view_fits turns the view down
+        view.x_scale = (int)min((int64_t)view.x_scale * (int)params.x_scale, (int64_t)INT_MAX);
+        view.y_scale = (int)min((int64_t)view.y_scale * (int)params.y_scale, (int64_t)INT_MAX);
+        break;
+    }
+}
+
+/**
+ * Writes output rows y0 to y0+count-1 of the view into out.
+ * @param view   The view
+ * @param y0     First output row
+ * @param count  Number of rows
+ * @param out    Receives the rows
+ * @param stride Bytes from one row of out to the next
+ */
+void view_rows(const ImageView& view, int y0, int count, unsigned char* out, size_t stride)
+{
+    const Image& image = *view.source;
+    int x_scale = view.x_scale;
+    int y_scale = view.y_scale;
+    size_t row_size = (size_t)view.output_width() * 3;
+    // Bytes from one source pixel to the next along u
+    ptrdiff_t step = 3 * (ptrdiff_t)view.xx + (ptrdiff_t)image.stride * view.yx;
+    int v_first = y0 / y_scale;
+    int v_last = (y0 + count - 1) / y_scale;
+    for (int v0 = v_first; v0 <= v_last; v0 += TILE) {
+        int v1 = min(v0 + TILE, v_last + 1);
+        for (int u0 = 0; u0 < view.width; u0 += TILE) {
+            int u1 = min(u0 + TILE, view.width);
+            for (int v = v0; v < v1; v++) {
+                // Each oriented row is built once, in the first output row showing it
+                unsigned char* row = out + stride * (max(v * y_scale, y0) - y0);
+                unsigned char* pixel = row + 3 * (size_t)u0 * x_scale;
+                const unsigned char* in = image.pixels.data()
+                    + 3 * (ptrdiff_t)(view.origin_x + view.xx * u0 + view.xy * v)
+                    + (ptrdiff_t)image.stride * (view.origin_y + view.yx * u0 + view.yy * v);
+                for (int u = u0; u < u1; u++, in += step) {
+                    for (int i = 0; i < x_scale; i++) {
+                        pixel[0] = in[0];
+                        pixel[1] = in[1];
+                        pixel[2] = in[2];
+                        pixel += 3;
+                    }
+                }
+            }
+        }
+        for (int v = v0; v < v1; v++) {
+            int first = max(v * y_scale, y0);
+            int last = min((v + 1) * y_scale, y0 + count);
+            for (int y = first + 1; y < last; y++) {
+                memcpy(out + stride * (y - y0), out + stride * (first - y0), row_size);
+            }
+        }
+    }
+}
+
+// Returns true if the view's output fits in a BMP file (see scale_fits)
+bool view_fits(const ImageView& view)
+{
+    return scale_fits(view.width, view.height, view.x_scale, view.y_scale);
+}
+
+// Returns the view as an image, or an empty image if it is too large
+Image realise_view(const ImageView& view)
+{
+    if (is_identity(view)) {
+        return *view.source;
+    }
+    if (!view_fits(view)) {
+        return Image();
+    }
+    Image new_image(view.output_width(), view.output_height());
+    parallel_rows(new_image.height, new_image.stride, [&](int first, int last) {
+        view_rows(view, first, last - first, new_image.row(first), new_image.stride);
+    });
+    return new_image;
+}
+
+/**
+ * Writes the view as a BMP file band by band, without realising it.
+ * @param filename The BMP file name to save the image to
+ * @param view     The view to write
+ * @return True if successful and false otherwise
+ */
+bool write_view(string filename, const ImageView& view)
+{
+    if (is_identity(view)) {
+        return write_image(filename, *view.source);
+    }
+    if (!view_fits(view) || view.source->empty()) {
+        return false;
+    }
+    METRICS_SPAN(STAGE_WRITE);
+    remove_output(filename);
+    fstream stream;
+    stream.open(filename, ios::out | ios::binary);
+    if (!stream.is_open()) {
+        return false;
+    }
+    int width = view.output_width();
+    int height = view.output_height();
+    unsigned char header[BMP_FILE_HEADER_SIZE];
+    encode_bmp_header(header, width, height);
+    stream.write((char*)header, sizeof(header));
+    size_t stride = bmp_encoded_size(width, 1) - BMP_FILE_HEADER_SIZE;
+    METRICS_COUNT(COUNTER_BYTES_WRITTEN, BMP_FILE_HEADER_SIZE + (uint64_t)stride * height);
+    int rows = (int)min((size_t)height, max(WRITE_BAND_BYTES / stride, (size_t)TILE));
+    vector<unsigned char> band(stride * rows, 0);
+    for (int y0 = 0; y0 < height; y0 += rows) {
+        int count = min(rows, height - y0);
+        parallel_rows(count, stride, [&](int first, int last) {
+            view_rows(view, y0 + first, last - first, band.data() + stride * first, stride);
+        });
+        stream.write((const char*)band.data(), (streamsize)(stride * count));
+    }
+    stream.close();
+    return !stream.fail();
+}
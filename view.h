@@ -0,0 +1,56 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include "image.h"
+
+/**
+ * A lazily rotated, flipped and enlarged image: a coordinate transform over a
+ * source image that is only realised when the pixels are needed. Output pixel
+ * (x, y) is pixel (u, v) = (x / x_scale, y / y_scale) of the oriented image,
+ * which is source pixel (origin_x + xx*u + xy*v, origin_y + yx*u + yy*v).
+ * Rotations and flips commute with pixel replication, so any sequence of
+ * them composes into this one form.
+ */
+struct ImageView {
+	const Image* source;
+	int width, height;
+	int origin_x, origin_y;
+	int xx, xy, yx, yy;
+	int x_scale, y_scale;
+
+	int output_width() const { return width * x_scale; }
+	int output_height() const { return height * y_scale; }
+};
+
+// Returns a view showing the image as it is
+ImageView make_view(const Image& image);
+
+// Returns true if the view shows its source as it is
+bool is_identity(const ImageView& view);
+
+// Returns true if the processor only moves pixels and can be added to a view (rotations, flips and whole scale enlarges)
+bool is_view_op(int userChoice, const FilterParams& params);
+
+// Adds the processor (see is_view_op) to the view
+void apply_view_op(ImageView& view, int userChoice, const FilterParams& params);
+
+/**
+ * Writes output rows y0 to y0+count-1 of the view into out, one stride apart.
+ * Rotated views are read in square tiles so the source stays in cache, and
+ * rows repeated by the enlarge are built once and copied.
+ */
+void view_rows(const ImageView& view, int y0, int count, unsigned char* out, size_t stride);
+
+// Returns true if the view's output fits in a BMP file (see scale_fits)
+bool view_fits(const ImageView& view);
+
+// Returns the view as an image, or an empty image if it is too large
+Image realise_view(const ImageView& view);
+
+/**
+ * Writes the view as a BMP file band by band, without realising it.
+ * @return True if successful and false otherwise
+ */
+bool write_view(string filename, const ImageView& view);
+
+#endif
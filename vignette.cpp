@@ -0,0 +1,83 @@
+#include "vignette.h"
+#include <list>
+#include <mutex>
+
+// Number of masks kept for reuse
+const size_t MASK_CACHE_SIZE = 16;
+
+// Bytes of weights kept for reuse; a mask is about a sixth of the bytes of its image
+const size_t MASK_CACHE_BYTES = (size_t)64 << 20;
+
+// Bytes of weights in a mask
+static size_t mask_bytes(const VignetteMask& mask)
+{
+    return mask.weights.size() * sizeof(uint16_t);
+}
+
+/**
+ * Computes the mask for an image size.
+ * @param width  Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @return The quadrant of weights
+ */
+shared_ptr<const VignetteMask> build_vignette_mask(int width, int height)
+{
+    shared_ptr<VignetteMask> mask(new VignetteMask());
+    mask->width = width;
+    mask->height = height;
+    mask->center_x = width / 2;
+    mask->center_y = height / 2;
+    mask->quadrant_width = mask->center_x + 1;
+    mask->quadrant_height = mask->center_y + 1;
+    mask->weights.resize((size_t)mask->quadrant_width * mask->quadrant_height);
+    for (int dy = 0; dy < mask->quadrant_height; dy++) {
+        uint16_t* weights = mask->weights.data() + (size_t)dy * mask->quadrant_width;
+        for (int dx = 0; dx < mask->quadrant_width; dx++) {
+            double distance = sqrt((pow(dy, 2)) + (pow(dx, 2)));
+            double scaling_factor = (((width - distance) / width)+((height - distance) / height))/2;
+            // Corners of very elongated images get negative factors, which the old clamp turned into 0
+            double weight = floor(scaling_factor * (1 << VIGNETTE_SHIFT) + 0.5);
+            weights[dx] = (uint16_t)(weight < 0 ? 0 : weight);
+        }
+    }
+    return mask;
+}
+
+/**
+ * Returns the mask for an image size, computing it on first use.
+ * Kernels ask for the mask on every row, so each thread holds on to the
+ * last mask it was given; that also keeps the mask alive if the shared
+ * cache evicts it meanwhile.
+ * @param width  Width of the image in pixels
+ * @param height Height of the image in pixels
+ * @return The cached mask
+ */
+const VignetteMask& vignette_mask(int width, int height)
+{
+    static mutex cache_lock;
+    static list<shared_ptr<const VignetteMask> > cache;
+    static size_t cache_bytes = 0;
+    thread_local shared_ptr<const VignetteMask> last;
+
+    if (last && last->width == width && last->height == height) {
+        return *last;
+    }
+    lock_guard<mutex> guard(cache_lock);
+    for (list<shared_ptr<const VignetteMask> >::iterator it = cache.begin(); it != cache.end(); it++) {
+        if ((*it)->width == width && (*it)->height == height) {
+            // Most recently used first
+            cache.splice(cache.begin(), cache, it);
+            last = cache.front();
+            return *last;
+        }
+    }
+    cache.push_front(build_vignette_mask(width, height));
+    cache_bytes += mask_bytes(*cache.front());
+    // The newest mask stays even if it alone is over the byte limit
+    while (cache.size() > 1 && (cache.size() > MASK_CACHE_SIZE || cache_bytes > MASK_CACHE_BYTES)) {
+        cache_bytes -= mask_bytes(*cache.back());
+        cache.pop_back();
+    }
+    last = cache.front();
+    return *last;
+}
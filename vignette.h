@@ -0,0 +1,41 @@
+#ifndef VIGNETTE_H
+#define VIGNETTE_H
+
+#include "image.h"
+#include <memory>
+
+/**
+ * Vignette weights for one image size.
+ * The scaling factor of a pixel depends only on its distance from the centre
+ * pixel (width / 2, height / 2), so only the quadrant of offsets |dx|, |dy| is
+ * stored. Weights are Q15 fixed point (32768 is 1.0), rounded from the double
+ * scaling factor and clamped at 0; scaling a channel by a weight truncates
+ * like the double formula did and differs from it by at most 1.
+ */
+struct VignetteMask {
+	int width;
+	int height;
+	int center_x;
+	int center_y;
+	int quadrant_width;   // center_x + 1: the largest |dx| is center_x
+	int quadrant_height;  // center_y + 1
+	vector<uint16_t> weights;
+
+	// Weights of the pixels dy rows above or below the centre, indexed by |dx|
+	const uint16_t* row(int dy) const { return weights.data() + (size_t)dy * quadrant_width; }
+};
+
+// Fixed point of the mask weights
+const int VIGNETTE_SHIFT = 15;
+
+// Computes the mask for an image size
+shared_ptr<const VignetteMask> build_vignette_mask(int width, int height);
+
+/**
+ * Returns the mask for an image size, computing it on first use. The most
+ * recently used masks (up to 16, and up to 64 MB of them) are kept, so a
+ * batch of images of a few sizes computes each mask once.
+ */
+const VignetteMask& vignette_mask(int width, int height);
+
+#endif